@@ -0,0 +1,33 @@
+#ifndef NODE_ACCUMULATE
+#define NODE_ACCUMULATE
+
+#include <vector>
+#include <data/numbers.hpp>
+
+// Sums and products of many rationals. Adding or multiplying rationals one
+// at a time reduces every intermediate result, which costs a gcd at each
+// step on numbers that keep growing. Instead, we keep numerators and
+// denominators unreduced, combine terms pairwise in a balanced tree so that
+// the numbers multiplied together have similar sizes, and reduce once at
+// the end. The result is the same as it would have been otherwise.
+namespace Diophant {
+    using namespace data;
+
+    struct fraction {
+        Z Numerator;
+        Z Denominator;
+
+        fraction (const Q &q, bool negative = false) :
+            Numerator {negative ? -q.Numerator : q.Numerator}, Denominator {Z (q.Denominator)} {}
+
+        fraction (const Z &n, const Z &d) : Numerator {n}, Denominator {d} {}
+
+        Q reduce () const;
+    };
+
+    Q sum (std::vector<fraction> &&);
+    Q product (std::vector<fraction> &&);
+
+}
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef NODE_BATCH
+#define NODE_BATCH
+
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "expression.hpp"
+
+// Evaluation of one expression over many rows of inputs at once. The
+// expression is compiled once into a sequence of instructions, which are
+// run over a batch of rows at a time, one instruction after another, so
+// that the work done for each row is only arithmetic.
+namespace Diophant {
+
+    // The values of one symbol for many rows. As long as every value is an
+    // integer that fits in a machine word, a column holds words, which are
+    // much faster to work with. Otherwise it holds exact rationals.
+    struct column {
+        bool Exact {false};
+        std::vector<int64> Words;
+        std::vector<Q> Rationals;
+
+        // A row whose value is undefined, such as the result of a division
+        // by zero, has a one here and a value of zero. This is empty as long
+        // as every value is defined.
+        std::vector<uint8> Undefined;
+
+        size_t size () const {
+            return Exact ? Rationals.size () : Words.size ();
+        }
+
+        bool defined (size_t i) const {
+            return Undefined.empty () || Undefined[i] == 0;
+        }
+
+        Q operator [] (size_t i) const;
+
+        void push_back (int64);
+        void push_back (const Q &);
+        void push_undefined ();
+
+        // change to exact rationals.
+        void promote ();
+    };
+
+    // Read a number such as 12, -1.5 or 2/3 exactly and add it to a column.
+    // Integers that fit in a word are read without allocating anything.
+    void read_number (std::string_view, column &);
+
+    // Append the values of a column to a string, one per line. An undefined
+    // value is written as "undefined".
+    void write_lines (std::string &, const column &);
+
+    struct program {
+        // the number of rows that are evaluated together.
+        static constexpr size_t Batch = 1024;
+
+        // Symbols named in columns take their values from the columns of the
+        // same position. Any other symbol must have a rational value in vars.
+        // Throws if the expression uses anything other than numbers and the
+        // operators + - * / and unary -.
+        program (value, const std::vector<data::string> &columns, const scope &vars);
+
+        // The value of the expression in every row. Columns must be given in
+        // the same order as their names were and must be the same size. A
+        // row in which the expression has no value, because of a division by
+        // zero, is undefined in the result; this costs no more than any
+        // other row.
+        column operator () (const std::vector<const column *> &) const;
+
+        // The same for a given number of rows. Columns that the program
+        // does not use may be null.
+        column run (const std::vector<const column *> &, size_t rows) const;
+
+        bool uses (size_t column) const {
+            return Used[column];
+        }
+
+    private:
+        enum class op : uint8 {
+            load,
+            constant,
+            negate,
+            plus,
+            minus,
+            times,
+            divide
+        };
+
+        // The result of each instruction is kept in a register with the same
+        // index as the instruction. A and B are the registers of the operands
+        // or, for load and constant, the index of the column or constant.
+        struct instruction {
+            op Op;
+            uint32 A;
+            uint32 B;
+        };
+
+        std::vector<instruction> Code;
+        std::vector<Q> Constants;
+        size_t Columns;
+        std::vector<bool> Used;
+
+        // identical subexpressions are compiled once.
+        std::unordered_map<uint64, std::vector<std::pair<ref<const expression>, uint32>>> Compiled;
+
+        uint32 compile (value, const std::vector<data::string> &columns, const scope &vars);
+        uint32 emit (value, instruction);
+    };
+
+}
+
+#endif
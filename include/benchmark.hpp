@@ -0,0 +1,17 @@
+#ifndef NODE_BENCHMARK
+#define NODE_BENCHMARK
+
+#include <ostream>
+#include "types.hpp"
+
+namespace Cosmos {
+
+    // Run the benchmark suite and write a report. Inputs of growing size
+    // are generated for several code paths and the growth of time and
+    // memory with size is measured. Returns false if any path grows
+    // faster than its declared complexity.
+    bool benchmark (std::ostream &);
+
+}
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef NODE_BUDGET
+#define NODE_BUDGET
+
+#include <chrono>
+#include <exception>
+#include <string>
+#include <data/numbers.hpp>
+#include "types.hpp"
+
+namespace Diophant {
+    using namespace data;
+
+    // Limits on what a single statement may use, so that one bad statement
+    // cannot hold up everyone else who shares the process. Zero means that
+    // there is no limit.
+    struct budget {
+        // evaluation steps, including rewrites and products of terms of polynomials.
+        uint64 Steps {0};
+
+        // expression nodes created.
+        uint64 Nodes {0};
+
+        // memory taken by the digits of the numbers that are created.
+        uint64 Bytes {0};
+
+        std::chrono::milliseconds Time {0};
+
+        // the budget of a new session.
+        static budget &standard ();
+    };
+
+    enum class resource {
+        steps,
+        nodes,
+        bytes,
+        time
+    };
+
+    const char *name (resource);
+
+    // thrown when a statement goes over its budget.
+    struct budget_exceeded : std::exception {
+        resource Resource;
+        uint64 Limit;
+        std::string Message;
+
+        budget_exceeded (resource, uint64 limit);
+
+        const char *what () const noexcept override {
+            return Message.c_str ();
+        }
+    };
+
+    // the memory taken by the digits of a number.
+    uint64 size_of (const Q &);
+
+    // Counts what the current thread uses for as long as it exists. The
+    // functions below are called by the evaluator and do nothing unless the
+    // thread is metered, so they cost a branch on a thread local variable.
+    struct meter {
+        using clock = std::chrono::steady_clock;
+
+        meter (const budget &);
+        ~meter ();
+        meter (const meter &) = delete;
+        meter &operator = (const meter &) = delete;
+
+        static void step () {
+            if (Current != nullptr) Current->spend_step ();
+        }
+
+        static void node () {
+            if (Current != nullptr) Current->spend_node ();
+        }
+
+        static void bytes (uint64 n) {
+            if (Current != nullptr) Current->spend_bytes (n);
+        }
+
+        // throws if we cannot afford n more bytes. This is for checking
+        // before we begin something expensive rather than after.
+        static void reserve (uint64 n) {
+            if (Current != nullptr) Current->check_bytes (n);
+        }
+
+        // we only look at the clock once in this many steps.
+        static constexpr uint64 ClockInterval = 256;
+
+    private:
+        budget Limits;
+        uint64 Steps {0};
+        uint64 Nodes {0};
+        uint64 Bytes {0};
+        clock::time_point Deadline;
+        meter *Previous;
+
+        static thread_local meter *Current;
+
+        void spend_step ();
+        void spend_node ();
+        void spend_bytes (uint64);
+        void check_bytes (uint64) const;
+    };
+
+}
+
+#endif
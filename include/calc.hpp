@@ -1,24 +1,87 @@
 #ifndef NODE_CALC
 #define NODE_CALC
 
+#include <istream>
+#include <ostream>
 #include <tao/pegtl.hpp>
 #include "types.hpp"
+#include "budget.hpp"
+#include "batch.hpp"
+
+namespace Diophant {
+    struct environment;
+}
 
 namespace Cosmos {
-    // running calculator program.
-    void calc ();
+    struct journal;
+
+    // Running calculator program. If a journal is given, definitions and
+    // rules are recovered from it and every new one is recorded in it.
+    void calc (ptr<journal> = nullptr);
+
+    // Evaluate statements, one per line, without the REPL, and write each
+    // result on its own line. Stops at the first statement that cannot be
+    // evaluated and returns false.
+    bool evaluate (std::istream &statements, std::ostream &results);
+
+    // the environment that sessions share unless they are given another.
+    ptr<Diophant::environment> standard_environment ();
+
+    // A set of definitions against which statements are evaluated. A
+    // session sees everything in its shared environment as well as its own
+    // definitions, which no other session sees until they are published.
+    // Different sessions may be used in different threads at the same time,
+    // but a single session may only be used by one thread at a time.
+    struct session {
+        session ();
+        session (ptr<Diophant::environment>);
+        ~session ();
+
+        // read and evaluate a statement. Returns the result as a
+        // string, or nothing if the statement produced no value.
+        maybe<string> operator () (const string &statement);
+
+        // add this session's definitions to the shared environment.
+        void publish ();
+
+        // Recover definitions and rules from a journal, and from now on
+        // record in it every definition and rule that a statement makes,
+        // including those made before the statement failed.
+        void journal_to (ptr<journal>);
+
+        // read an expression without evaluating it. Throws if it cannot be read.
+        Diophant::value read (const string &expression);
+
+        // Compile an expression for evaluation over many rows at once, with
+        // values of the given symbols taken from columns. Other symbols are
+        // given the values that they have in this session.
+        Diophant::program compile (const string &expression, const std::vector<string> &columns);
+
+        // limits on each statement, which start out as budget::standard ().
+        Diophant::budget Budget;
+
+    private:
+        ptr<Diophant::environment> Shared;
+        ptr<journal> Journal;
+
+        struct local;
+        std::unique_ptr<local> Local;
+    };
 }
 
 namespace Diophant::parse {
     using namespace tao::pegtl;
+    // not data::string.
+    using tao::pegtl::string;
 
     struct ws : star<space> {};
 
-    struct hex_digit : seq<xdigit, xdigit> {};
-    struct hex_lit : seq<string<'0', 'x'>, star<hex_digit>> {};
+    // every hex digit is read, so that an odd number of them is an error rather than a shorter literal.
+    struct hex_lit : seq<string<'0', 'x'>, star<xdigit>> {};
     struct dec_lit : sor<one<'0'>, seq<range<'1', '9'>, star<digit>>> {};
 
-    struct number_lit : sor<dec_lit, hex_lit> {};
+    // hex literals are byte strings, not numbers.
+    struct number_lit : seq<dec_lit> {};
 
     struct string_body : star<sor<
         seq<not_at<sor<one<'\\'>, one<'"'>>>, ascii::print>,  // any ascii character other than \ and "
@@ -43,13 +106,19 @@ namespace Diophant::parse {
             star<seq<ws, one<','>, ws, expression>>, ws, 
         close_paren> {};
         
-    struct list : seq<one<'['>, ws, 
+    struct open_list : one<'['> {};
+    struct close_list : one<']'> {};
+
+    struct list : seq<open_list, ws, 
             opt<seq<expression, ws, opt<star<seq<one<','>, ws, expression, ws>>>>>, 
-        one<']'>> {};
+        close_list> {};
+
+    struct open_object : one<'{'> {};
+    struct close_object : one<'}'> {};
     
-    struct map : seq<one<'{'>, ws, opt<
+    struct map : seq<open_object, ws, opt<
         seq<symbol, ws, one<':'>, ws, expression, ws, opt<star<
-            seq<one<','>, ws, symbol, ws, one<':'>, expression, ws>>>>>, one<'}'>> {};
+            seq<one<','>, ws, symbol, ws, one<':'>, ws, expression, ws>>>>>, close_object> {};
 
     struct typed_input : seq<one<'.'>, ws, type_expression> {};
     struct untyped_input : seq<one<';'>> {};
@@ -57,8 +126,8 @@ namespace Diophant::parse {
     struct structure;
     struct call : seq<plus<space>, structure> {};
     struct part : seq<one<'@'>, sor<number_lit, symbol>> {};
-    struct structure : seq<sor<number_lit, string_lit, 
-        seq<symbol, typed_input, untyped_input>, 
+    struct structure : seq<sor<hex_lit, number_lit, string_lit, 
+        seq<symbol, opt<sor<typed_input, untyped_input>>>, 
         parenthetical, list, map>, star<part>, star<call>> {};
 
     struct unary_operator : sor<one<'~'>, one<'+'>, one<'*'>> {};
@@ -125,7 +194,7 @@ namespace Diophant::parse {
     
     struct set : seq<one<'='>, ws, expression> {};
     struct infer : seq<string<':', '='>, ws, expression> {};
-    struct declare : seq<one<':'>, ws, expression, opt<set>> {};
+    struct declare : seq<one<':'>, ws, expression, opt<ws, set>> {};
 
     struct statement : seq<expression, opt<ws, sor<infer, set, declare>>> {};
 
@@ -0,0 +1,27 @@
+#ifndef NODE_CSV
+#define NODE_CSV
+
+#include <ostream>
+#include "types.hpp"
+
+namespace Cosmos {
+
+    // Evaluate an expression for every row of a CSV file and write the
+    // results, one per line, in the order of the rows. The first line of
+    // the file names the columns, and each column is bound to the symbol
+    // of the same name. Fields are separated by commas and cannot be quoted.
+    // A field may be an integer, a decimal number or a fraction such as 2/3.
+    // A row whose result has no value, because of a division by zero, is
+    // written as undefined.
+    //
+    // The file is mapped into memory and split at row boundaries into a
+    // chunk for each core. Chunks are read and evaluated in parallel, and
+    // fields are read straight from the mapped file. Only columns that the
+    // expression uses are read. The results of each chunk are written as
+    // soon as it and the chunks before it are done, so if a row cannot be
+    // read, the results of the chunks before it have already been written.
+    void csv (const string &path, const string &expression, std::ostream &results);
+
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef NODE_DIGEST
+#define NODE_DIGEST
+
+#include <string_view>
+#include <vector>
+#include "types.hpp"
+
+namespace Diophant {
+    using namespace data;
+
+    // The hash functions used in Bitcoin. hash256 is sha256 twice and
+    // hash160 is ripemd160 of sha256.
+    enum class hash_function {sha256, hash256, ripemd160, hash160};
+
+    const char *name (hash_function);
+
+    // the size of a digest in bytes.
+    size_t digest_size (hash_function);
+
+    // Write the digest of the input to out, which has room for it. The
+    // digests are computed with OpenSSL's EVP interface, which comes with
+    // the data library. Throws if OpenSSL fails.
+    void digest (hash_function, std::string_view, byte *out);
+
+    // Write the digest of every input to out, one after another. A long
+    // list is divided among the hardware threads. SHA-256 uses the SHA
+    // extensions of the processor when it has them.
+    void digest (hash_function, const std::vector<std::string_view> &, byte *out);
+
+}
+
+#endif
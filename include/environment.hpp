@@ -0,0 +1,146 @@
+#ifndef NODE_ENVIRONMENT
+#define NODE_ENVIRONMENT
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include "expression.hpp"
+
+namespace Diophant {
+
+    using bindings = std::map<data::string, value>;
+
+    // A version of the shared environment. Numbers are never reused, even
+    // after a version is freed, so they can be remembered in its place.
+    struct snapshot {
+        bindings Values;
+        uint64 Number {0};
+    };
+
+    // Epoch-based reclamation for data that many threads read and few
+    // threads replace. A reader announces the epoch in which it began
+    // reading and withdraws the announcement when it is done. Data that
+    // has been replaced is retired with the epoch in which it was replaced
+    // and can be freed once every reader that is still reading began in a
+    // later epoch. Readers only ever write to their own slot, so they do
+    // not slow each other down.
+    namespace epoch {
+
+        // marks the current thread as reading for as long as it exists.
+        // Guards may be nested.
+        struct guard {
+            guard ();
+            ~guard ();
+            guard (const guard &) = delete;
+            guard &operator = (const guard &) = delete;
+        };
+
+        // begin a new epoch. Returns the epoch that ended.
+        uint64 advance ();
+
+        // the earliest epoch in which a reader that is still reading began.
+        uint64 oldest ();
+
+    }
+
+    // Definitions that are shared between sessions. Each version of the
+    // environment is immutable. To change it, we copy the current version,
+    // change the copy, and publish it, so readers never take a lock.
+    struct environment {
+        environment (bindings &&);
+        ~environment ();
+
+        // The current version, which remains valid for as long as the
+        // thread holds an epoch::guard.
+        const snapshot &current () const;
+
+        // publish a new version with these definitions added.
+        void define (const bindings &);
+
+        // the number of versions that have been published.
+        uint64 version () const {
+            return Version.load (std::memory_order_relaxed);
+        }
+
+        // Free replaced versions that no reader can see any more. This is
+        // done whenever a version is published, but a version retired by
+        // the last publication is only freed once someone calls this after
+        // its readers are done, as sessions do. Returns at once if there
+        // is nothing to free or if someone is publishing.
+        void reclaim ();
+
+    private:
+        std::atomic<const snapshot *> Current;
+        std::atomic<uint64> Version {1};
+
+        // writers are rare, so they take turns.
+        std::mutex Writing;
+        std::vector<std::pair<const snapshot *, uint64>> Retired;
+        std::atomic<size_t> Retiring {0};
+
+        // free what we can while holding Writing.
+        void free_retired ();
+    };
+
+    // The values of a session's own definitions, which are kept until
+    // something that they depend on is redefined. Dependencies are recorded
+    // as definitions are evaluated: whenever a symbol is looked up while a
+    // definition is being evaluated, the definition depends on the symbol.
+    // Redefining a symbol forgets the values of everything that depends on
+    // it, transitively, and nothing else.
+    struct memo {
+        struct entry {
+            ref<const expression> Value {nullptr};
+            bool Known {false};
+            bool Computing {false};
+            std::set<data::string> Dependents {};
+        };
+
+        std::map<data::string, entry> Entries;
+
+        // the definitions that are being evaluated, innermost last.
+        std::vector<data::string> Computing;
+
+        // the types that have been inferred for symbols, which are forgotten whenever the generation changes.
+        typing Types;
+
+        // the number of the snapshot of the shared environment that the values were computed with.
+        uint64 Shared {0};
+
+        // Changes whenever a definition that the session can see may have
+        // changed, and is never the same for two different memos, so that
+        // anything else computed from the definitions can be kept until
+        // this changes.
+        uint64 Generation;
+
+        memo ();
+
+        void invalidate (const data::string &);
+
+        void clear ();
+    };
+
+    // What an evaluation can see: a session's own definitions over a
+    // version of the shared environment. Definitions made by a session are
+    // visible only to that session until they are published.
+    struct scope {
+        const bindings &Shared;
+        bindings &Local;
+        memo &Memo;
+
+        scope (const snapshot &shared, bindings &local, memo &m);
+
+        // returns nullptr if the symbol is not defined.
+        const ref<const expression> *find (const data::string &) const;
+
+        // the value of a symbol.
+        value evaluate (const data::string &) const;
+
+        // Define or redefine a symbol. Anything that depends on a previous
+        // definition will be evaluated again when it is next needed.
+        void define (const data::string &, value);
+    };
+
+}
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef NODE_EXPRESSION
+#define NODE_EXPRESSION
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <vector>
+#include <ostream>
+#include <data/numbers.hpp>
+#include "stats.hpp"
+#include "hash.hpp"
+#include "budget.hpp"
+#include "rope.hpp"
+#include "ref.hpp"
+
+namespace Diophant {
+
+    using namespace data;
+
+    struct expression;
+    struct scope;
+    using value = const ref<const expression>;
+
+    // Expressions count their own references. A graph of expressions belongs
+    // to the session that made it until it is frozen, and must be frozen
+    // before any other thread can see it; see counted in ref.hpp.
+    struct expression : counted {
+
+        static value null ();
+        static value boolean (bool b);
+        static value rational (const data::Q &q);
+        static value symbol (const data::string &x);
+        static value string (const data::string &str);
+        static value string (const rope &str);
+        static value bytes (const data::bytes &b);
+        static value list (const data::list<value> &ls);
+        static value list (std::vector<ref<const expression>> &&ls);
+        static value object (const data::list<data::entry<data::string, value>> &x);
+        static value object (const std::vector<data::string> &keys, std::vector<ref<const expression>> &&values);
+
+        // A function provided by the program. If prepare is given, it is
+        // called before evaluation with any argument that is known in advance.
+        static value builtin (const data::string &name, std::function<value (value)> f,
+            std::function<void (value)> prepare = nullptr);
+
+        // The result of an operation that has no value, such as a division
+        // by zero or an undefined symbol. Errors are values so that they
+        // can be passed along without unwinding the stack; any operation on
+        // an error is the same error. They are only turned into exceptions
+        // once a statement has been evaluated.
+        static value error (const data::string &message);
+
+        static value apply (const value, const value);
+        static value part (const value, const value);
+
+        static value negate (const value);
+        static value plus (const value, const value);
+        static value minus (const value, const value);
+        static value times (const value, const value);
+        static value power (const value, const value);
+        static value divide (const value, const value);
+
+        static value equal (const value, const value);
+        static value unequal (const value, const value);
+        static value greater_equal (const value, const value);
+        static value less_equal (const value, const value);
+        static value greater (const value, const value);
+        static value less (const value, const value);
+
+        static value boolean_not (const value);
+        static value boolean_and (const value, const value);
+        static value boolean_or (const value, const value);
+
+        static value arrow (const value, const value);
+
+        static value intuitionistic_and (const value, const value);
+        static value intuitionistic_or (const value, const value);
+        static value intuitionistic_implies (const value, const value);
+
+        expression () {
+            meter::node ();
+            stats::allocated ();
+        }
+
+        virtual ~expression () {
+            stats::freed ();
+        };
+
+        ref<const expression> self () const {
+            return ref<const expression> {this};
+        }
+
+        // Make this expression and everything that it refers to safe to
+        // share with other threads. Everything that a frozen expression
+        // refers to is already frozen, so this stops there.
+        virtual void freeze () const;
+
+        virtual stats::node kind () const = 0;
+
+        // A hash of the structure of the expression, which is computed
+        // the first time it is needed and then kept.
+        uint64 hash () const {
+            uint64 h = Hash.load (std::memory_order_relaxed);
+            if (h == 0) {
+                h = compute_hash ();
+                // zero means that the hash has not been computed.
+                if (h == 0) h = 1;
+                Hash.store (h, std::memory_order_relaxed);
+            }
+
+            return h;
+        }
+
+        // structural equality with an expression of the same kind.
+        virtual bool identical (const expression &) const = 0;
+
+        // Subexpressions, for algorithms that walk over any kind of expression.
+        virtual size_t arity () const {
+            return 0;
+        }
+
+        virtual value child (size_t) const {
+            return nullptr;
+        }
+
+        // a copy of this expression with different subexpressions.
+        virtual value with (std::vector<ref<const expression>> &&) const {
+            return self ();
+        }
+
+        // identifies an expression apart from its subexpressions.
+        virtual uint64 head () const {
+            return arity () == 0 ? hash () : uint64 (kind ());
+        }
+
+        virtual std::ostream &write (std::ostream &) const = 0;
+
+        data::string write () const {
+            std::stringstream ss;
+            write (ss);
+            return ss.str ();
+        }
+
+        // How loosely the expression binds when it is written, following
+        // the levels of the grammar. Every operator in the grammar is right
+        // associative, so a left operand is written in parentheses if it
+        // binds as loosely as its parent or more, and a right operand only
+        // if it binds more loosely. Zero is for anything that is never
+        // written in parentheses.
+        virtual uint32 precedence () const {
+            return 0;
+        }
+
+        virtual value evaluate (const scope &vars) const {
+            return self ();
+        };
+
+        // Called before a statement is evaluated when this is applied to an
+        // argument that does not need to be evaluated, so that slow work such
+        // as a database query can be started early.
+        virtual void prepare (const value) const {}
+
+        virtual value operator () (const value) const;
+        virtual value part (const value) const;
+        virtual value operator - () const;
+        virtual value operator ! () const;
+
+        virtual value operator + (const value) const;
+        virtual value operator - (const value) const;
+        virtual value operator * (const value) const;
+        virtual value operator / (const value) const;
+        virtual value operator ^ (const value) const;
+
+        virtual value operator == (const value) const;
+        virtual value operator != (const value) const;
+        virtual value operator <= (const value) const;
+        virtual value operator >= (const value) const;
+        virtual value operator < (const value) const;
+        virtual value operator > (const value) const;
+
+        virtual value operator && (const value) const;
+        virtual value operator || (const value) const;
+        virtual value arrow (const value) const;
+
+        virtual value operator & (const value) const;
+        virtual value operator | (const value) const;
+        virtual value implies (const value) const;
+
+        // called by hash (), which should be used instead.
+        virtual uint64 compute_hash () const = 0;
+
+    private:
+        mutable std::atomic<uint64> Hash {0};
+
+    };
+
+    uint64 inline structural_hash (const value v) {
+        if (v == nullptr) return 0x6e756c6c;
+        return v->hash ();
+    }
+
+    // Two expressions are identical if they have the same structure. We
+    // only need to look at the structure if they have the same kind and
+    // hash and are not the same object.
+    bool inline identical (const value a, const value b) {
+        if (a.get () == b.get ()) return true;
+        if (a == nullptr || b == nullptr) return false;
+        if (a->kind () != b->kind () || a->hash () != b->hash ()) return false;
+        return a->identical (*b);
+    }
+
+    value evaluate (value v, const scope &vars);
+
+    bool inline is_error (const value v) {
+        return v != nullptr && v->kind () == stats::node::error;
+    }
+
+    // the message of an error, or nothing if the expression is not an error.
+    maybe<data::string> error_message (value);
+
+    // the contents of a string, or nothing if the expression is not a string.
+    maybe<data::string> string_value (value);
+
+    // the value of a rational, or nothing if the expression is not a rational.
+    maybe<Q> rational_value (value);
+
+    // the contents of a byte string, or nothing if the expression is not one.
+    maybe<data::bytes> bytes_value (value);
+
+    // Types that can be proven before an expression is evaluated. An
+    // expression of a proven type evaluates to a value of that type or to
+    // an error.
+    enum class type {unknown, rational, boolean, string};
+
+    // the types of symbols.
+    using typing = std::map<data::string, type>;
+
+    // Replace operations whose operands have proven types with nodes that
+    // use them without looking at them first. A symbol has the type of its
+    // definition, which is remembered in the memo of the scope until a
+    // definition changes.
+    value specialize (value, const scope &);
+
+    // null is the null pointer, which is written as it is read.
+    std::ostream inline &operator << (std::ostream &o, value v) {
+        if (v == nullptr) return o << "null";
+        return v->write (o);
+    }
+
+}
+
+#endif
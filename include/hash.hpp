@@ -0,0 +1,51 @@
+#ifndef NODE_HASH
+#define NODE_HASH
+
+#include <string_view>
+#include <data/numbers.hpp>
+#include "types.hpp"
+
+// Hash functions that give the same result on every platform and every
+// run of the program, so that hashes can be stored and compared.
+namespace Diophant {
+    using namespace data;
+
+    // the finalizer of splitmix64.
+    uint64 inline mix (uint64 x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111eb;
+        return x ^ (x >> 31);
+    }
+
+    uint64 inline combine (uint64 seed, uint64 x) {
+        return mix (seed ^ (x + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2)));
+    }
+
+    // 64-bit FNV-1a. A string given in pieces is hashed by passing the
+    // hash of each piece to the next.
+    uint64 inline hash_bytes (std::string_view x, uint64 h = 0xcbf29ce484222325) {
+        for (unsigned char c : x) {
+            h ^= c;
+            h *= 0x100000001b3;
+        }
+
+        return h;
+    }
+
+    // the sign and limbs of a number, without writing it out in decimal.
+    uint64 inline hash_number (const mpz_t x, uint64 h) {
+        h = combine (h, uint64 (mpz_sgn (x)));
+        for (size_t i = 0, n = mpz_size (x); i < n; i++) h = combine (h, uint64 (mpz_getlimbn (x, i)));
+        return h;
+    }
+
+    // the numerator, then the denominator.
+    uint64 inline hash_number (const Q &q, uint64 h) {
+        return hash_number (q.Denominator.Value.MPZ, hash_number (q.Numerator.MPZ, h));
+    }
+
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef NODE_HTTP
+#define NODE_HTTP
+
+#include "types.hpp"
+
+namespace Cosmos {
+
+    // start an HTTP server on a background thread. It serves
+    // evaluation statistics in Prometheus format at /metrics.
+    void start_http_listener (uint16 port);
+
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef NODE_JOURNAL
+#define NODE_JOURNAL
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "types.hpp"
+
+namespace Cosmos {
+
+    // An append-only file of definitions and rules, from which a session's
+    // definitions and rules can be recovered after the program stops. A
+    // record is either a symbol and the text of its definition, in which
+    // case a later record for the same symbol supersedes an earlier one,
+    // or the text of the two sides of a rule, which is never superseded.
+    //
+    // Records are not written when they are given. A thread writes
+    // everything that has been given since it last woke and then syncs the
+    // file, once per interval, so that a statement never waits for the
+    // disk, and at most one interval of definitions is lost in a crash.
+    // When most records in the file have been superseded, the same thread
+    // writes a new file with only the latest definition of each symbol
+    // and every rule, and moves it over the old one.
+    struct journal {
+        // Open the journal at the given path, or create it. Anything after
+        // the last complete record, such as a record that was being written
+        // during a crash, is cut off.
+        journal (const string &path, std::chrono::milliseconds interval);
+
+        // write and sync everything that has been given.
+        ~journal ();
+
+        // the latest definition of every symbol in the journal when it was opened.
+        const std::map<string, string> &recovered () const {
+            return Recovered;
+        }
+
+        // every rule in the journal when it was opened, in the order in which they were added.
+        const std::vector<std::pair<string, string>> &recovered_rules () const {
+            return RecoveredRules;
+        }
+
+        // Add a record. Throws if an earlier record could not be written.
+        void define (const string &name, const string &definition);
+        void rule (const string &left, const string &right);
+
+        // what a record is, which is its first byte in the file.
+        enum class kind : char {definition = 'd', rule = 'r'};
+
+        struct record {
+            kind Kind;
+            string First;
+            string Second;
+        };
+
+    private:
+        string Path;
+        std::chrono::milliseconds Interval;
+        int File;
+
+        std::map<string, string> Recovered;
+        std::vector<std::pair<string, string>> RecoveredRules;
+
+        // the latest definitions, the rules and the number of records in
+        // the file. These belong to the writing thread once it has started.
+        std::map<string, string> Latest;
+        std::vector<std::pair<string, string>> Rules;
+        size_t Records;
+
+        std::mutex Mutex;
+        std::condition_variable Stop;
+        std::vector<record> Pending;
+        bool Stopping;
+        maybe<string> Failed;
+
+        std::thread Writer;
+
+        void write ();
+        void append (const std::vector<record> &);
+        void keep (const record &);
+        void compact ();
+    };
+
+}
+
+#endif
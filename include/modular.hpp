@@ -0,0 +1,86 @@
+#ifndef NODE_MODULAR
+#define NODE_MODULAR
+
+#include <array>
+#include <string_view>
+#include "types.hpp"
+
+namespace Diophant {
+    using namespace data;
+
+    // an unsigned 256-bit number, least significant limb first.
+    using uint256 = std::array<uint64, 4>;
+
+    // Arithmetic modulo an odd number m < 2^256 in Montgomery form, in which
+    // x is stored as x * 2^256 mod m, so that multiplication needs no
+    // division. Numbers are always fully reduced. Nothing here branches on
+    // or looks up memory by the value of a number except to read and write
+    // them, so the time taken does not depend on any secret.
+    struct montgomery {
+        montgomery (const uint256 &modulus, const char *name);
+
+        // the builtin that makes numbers with this modulus.
+        const char *Name;
+
+        const uint256 &modulus () const {
+            return Modulus;
+        }
+
+        // into and out of Montgomery form. Any 256-bit number can be read.
+        uint256 in (const uint256 &) const;
+        uint256 out (const uint256 &) const;
+
+        uint256 zero () const {
+            return {0, 0, 0, 0};
+        }
+
+        uint256 one () const {
+            return One;
+        }
+
+        uint256 add (const uint256 &, const uint256 &) const;
+        uint256 subtract (const uint256 &, const uint256 &) const;
+        uint256 negate (const uint256 &) const;
+        uint256 multiply (const uint256 &, const uint256 &) const;
+
+        // the exponent is an ordinary number, not in Montgomery form.
+        uint256 pow (const uint256 &, const uint256 &exponent) const;
+
+        // The modulus must be prime. The inverse of zero is zero.
+        uint256 invert (const uint256 &) const;
+
+        // Invert every number at once with Montgomery's trick, which takes
+        // one inversion and three multiplications for each number. Returns
+        // false and changes nothing if any of them is zero.
+        bool invert (uint256 *, size_t) const;
+
+        // a number given in decimal, such as the digits of a Z.
+        uint256 read (std::string_view digits) const;
+
+        // the number in decimal.
+        data::string write (const uint256 &) const;
+
+        // the prime of the field over which secp256k1 is defined.
+        static const montgomery &secp256k1_p ();
+
+        // the order of the secp256k1 group.
+        static const montgomery &secp256k1_n ();
+
+    private:
+        uint256 Modulus;
+        // -1 / m mod 2^64.
+        uint64 Inverse;
+        // 2^256 and 2^512 mod m.
+        uint256 One;
+        uint256 R2;
+        // m - 2. A number to this power is its inverse because m is prime.
+        uint256 MinusTwo;
+    };
+
+    bool inline is_zero (const uint256 &x) {
+        return (x[0] | x[1] | x[2] | x[3]) == 0;
+    }
+
+}
+
+#endif
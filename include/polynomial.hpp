@@ -0,0 +1,85 @@
+#ifndef NODE_POLYNOMIAL
+#define NODE_POLYNOMIAL
+
+#include <stdexcept>
+#include <unordered_map>
+#include "expression.hpp"
+
+namespace Diophant {
+
+    // thrown when an exponent or a degree would not fit in 32 bits.
+    struct exponent_overflow : std::overflow_error {
+        exponent_overflow () : std::overflow_error {"exponent is too large"} {}
+    };
+
+    // A product of powers of atoms. An atom is any expression that is
+    // treated as an indeterminate, such as an unknown symbol. Factors are
+    // kept sorted so that equal monomials have equal representations.
+    // Operations that would make an exponent too big throw exponent_overflow.
+    struct monomial {
+        std::vector<std::pair<ref<const expression>, uint32>> Factors;
+
+        monomial () : Factors {} {}
+        static monomial atom (value);
+
+        // the sum of the exponents, which is counted in 64 bits so that it cannot overflow.
+        uint64 degree () const;
+
+        monomial operator * (const monomial &) const;
+
+        bool operator == (const monomial &) const;
+
+        uint64 hash () const;
+
+        std::ostream &write (std::ostream &) const;
+    };
+
+    struct monomial_hash {
+        size_t operator () (const monomial &m) const {
+            return size_t (m.hash ());
+        }
+    };
+
+    // A polynomial over Q in any number of atoms, stored as a map from
+    // monomials to nonzero coefficients. Like terms are combined as soon
+    // as they are created, so every polynomial is in its normal form.
+    struct sparse_polynomial {
+        std::unordered_map<monomial, Q, monomial_hash> Terms;
+
+        static sparse_polynomial constant (const Q &);
+        static sparse_polynomial atom (value);
+
+        // the value of a polynomial with no atoms.
+        maybe<Q> constant () const;
+
+        // the atom if this polynomial is nothing but an atom.
+        ref<const expression> atom () const;
+
+        sparse_polynomial operator - () const;
+        sparse_polynomial operator + (const sparse_polynomial &) const;
+        sparse_polynomial operator - (const sparse_polynomial &) const;
+        sparse_polynomial operator * (const sparse_polynomial &) const;
+        sparse_polynomial operator * (const Q &) const;
+        sparse_polynomial pow (uint32) const;
+
+        bool operator == (const sparse_polynomial &) const;
+
+        uint64 hash () const;
+
+        // the memory taken by the digits of the coefficients.
+        uint64 size () const;
+
+        // An upper bound on the memory taken by the coefficients of this
+        // polynomial to the nth power, or the largest uint64 if it is bigger.
+        uint64 power_size (uint32 n) const;
+
+        // terms are written in order of decreasing degree.
+        std::ostream &write (std::ostream &) const;
+
+    private:
+        void add (const monomial &, const Q &);
+    };
+
+}
+
+#endif
@@ -1,8 +1,13 @@
 #ifndef NODE_DATABASE
 #define NODE_DATABASE
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <pqxx/pqxx>
 #include "types.hpp"
+#include "expression.hpp"
 
 namespace Cosmos {
 
@@ -14,10 +19,95 @@ namespace Cosmos {
         }
 
         data::string connect_command () const;
+
+        static constexpr int ConnectTimeoutSeconds = 5;
     };
 
     ptr<pqxx::connection> connect_to_database (const postgres_URL &);
 
+    // Queries over a single connection in pipeline mode. A query that is
+    // sent does not wait for its result, so many queries can be sent before
+    // any are received and they will share round trips to the server.
+    // Queries run outside of a transaction. This may be used from any thread.
+    //
+    // Queries belong to the statement that sent them, which is given by its
+    // number, and only that statement can receive them. Queries that a
+    // statement sent but did not receive are discarded when it is over.
+    //
+    // We connect on a background thread the first time a query is sent, or
+    // when connect is called, and try again with increasing delays if we
+    // cannot. If the connection is lost, we connect again.
+    struct database {
+        database (const postgres_URL &);
+        ~database ();
+
+        // begin connecting unless we are connected or connecting already.
+        void connect ();
+
+        // Begin a query unless the statement has already sent the same
+        // query and not received it. The query goes to the server with the
+        // next query that anyone receives. Returns true if the statement
+        // had no other query waiting, in which case the caller must call
+        // discard once the statement is over.
+        bool send (uint64 statement, const string &sql);
+
+        // the result of a query, which is sent now if the statement has not sent it already.
+        pqxx::result receive (uint64 statement, const string &sql);
+
+        // Forget the queries of a statement that have not been received.
+        // The results of any that were sent are thrown away when they come.
+        void discard (uint64 statement);
+
+        static constexpr int MaxAttempts = 6;
+        static constexpr std::chrono::milliseconds FirstDelay {100};
+
+    private:
+        enum class status {
+            idle,
+            connecting,
+            connected,
+            failed
+        };
+
+        postgres_URL URL;
+
+        // Only the thread that holds Using touches the pipeline, and it
+        // does so without holding Mutex, so that nobody waits for the
+        // server in order to send or discard a query. Mutex is only ever
+        // taken while holding Using, never the other way around.
+        std::mutex Using;
+
+        std::mutex Mutex;
+        std::condition_variable Changed;
+        status Status {status::idle};
+        string Error {};
+        bool Stopping {false};
+        std::thread Connecting;
+
+        // these exist while we are connected.
+        ptr<pqxx::connection> Connection;
+        std::unique_ptr<pqxx::nontransaction> Transaction;
+        std::unique_ptr<pqxx::pipeline> Pipeline;
+
+        // queries that have been sent, or that will be sent once we are
+        // connected, by the statements that sent them.
+        std::map<std::pair<uint64, string>, maybe<pqxx::pipeline::query_id>> Waiting;
+
+        // queries that were sent but will never be received, whose results we have to take out of the pipeline.
+        std::vector<pqxx::pipeline::query_id> Abandoned;
+
+        void start (std::unique_lock<std::mutex> &);
+        void attempt ();
+        void disconnect ();
+        pqxx::result retrieve (uint64 statement, const string &sql);
+    };
+
+    // A builtin that takes a string of SQL and returns the rows of the
+    // result as a list of objects. Queries whose text is known before the
+    // statement is evaluated are sent together, and any of them that the
+    // statement does not use are discarded when it is over.
+    Diophant::value query_builtin (ptr<database>);
+
 }
 
 #endif
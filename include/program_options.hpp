@@ -2,6 +2,7 @@
 #define NODE_PROGRAM_OPTIONS
 
 #include "postgres.hpp"
+#include "budget.hpp"
 #include "argh.h"
 #include <types.hpp>
 
@@ -14,12 +15,39 @@ namespace Cosmos {
 
         maybe<uint16> HTTPListenerPort {};
 
+        // A statement to evaluate, or a file of statements, one per line,
+        // instead of starting the REPL. A file named - is standard input.
+        maybe<string> Eval {};
+        maybe<string> File {};
+
+        // limits on each statement.
+        Diophant::budget Budget {};
+
+        // A CSV file and an expression to evaluate for each of its rows.
+        maybe<string> CSV {};
+        maybe<string> Expression {};
+
+        // Or a query whose rows the expression is evaluated for instead,
+        // and optionally a table to copy the results into.
+        maybe<string> Query {};
+        maybe<string> Into {};
+
+        // A file in which the REPL records definitions, from which they are
+        // recovered when it starts again, and how often the file is synced.
+        maybe<string> Journal {};
+        std::chrono::milliseconds JournalInterval {100};
+
+        bool one_shot () const {
+            return bool (Eval) || bool (File) || bool (CSV) || bool (Query);
+        }
+
     private:
         program_options () {}
     };
 
     // everything that happens in the program after reading the program options.
-    void run (const program_options &);
+    // Returns the exit status.
+    int run (const program_options &);
 
 }
 
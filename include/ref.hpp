@@ -0,0 +1,137 @@
+#ifndef NODE_REF
+#define NODE_REF
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include "types.hpp"
+
+namespace Diophant {
+    using namespace data;
+
+    // A base for objects that count their own references. Most expressions
+    // are made and dropped by a single session, so their counts are changed
+    // with plain loads and stores, which are no more expensive than any
+    // other access to memory. Before an object can be seen by another
+    // thread, it must be frozen, after which its count is changed with
+    // atomic operations. An object cannot be thawed once it is frozen.
+    struct counted {
+        counted () {}
+
+        // a copy is a new object with no references to it.
+        counted (const counted &) {}
+        counted &operator = (const counted &) {
+            return *this;
+        }
+
+        void acquire () const {
+            if (Frozen.load (std::memory_order_relaxed)) Count.fetch_add (1, std::memory_order_relaxed);
+            else Count.store (Count.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        // true if that was the last reference.
+        bool release () const {
+            if (Frozen.load (std::memory_order_relaxed)) return Count.fetch_sub (1, std::memory_order_acq_rel) == 1;
+            uint32 n = Count.load (std::memory_order_relaxed) - 1;
+            Count.store (n, std::memory_order_relaxed);
+            return n == 0;
+        }
+
+        bool frozen () const {
+            return Frozen.load (std::memory_order_relaxed);
+        }
+
+    protected:
+        // The object must not yet be visible to any other thread. It becomes
+        // visible through something that is published with release ordering,
+        // such as a new version of an environment.
+        void freeze_count () const {
+            Frozen.store (true, std::memory_order_relaxed);
+        }
+
+    private:
+        mutable std::atomic<uint32> Count {0};
+        mutable std::atomic<bool> Frozen {false};
+    };
+
+    // A pointer to a counted object, which deletes the object when the last
+    // reference to it is gone. It works like std::shared_ptr, except that
+    // there is no control block, and that the count is not atomic unless the
+    // object is frozen.
+    template <typename X> struct ref {
+        ref () : Pointer {nullptr} {}
+        ref (std::nullptr_t) : Pointer {nullptr} {}
+
+        // the object may already have other references.
+        explicit ref (X *x) : Pointer {x} {
+            if (Pointer != nullptr) Pointer->acquire ();
+        }
+
+        ref (const ref &r) : ref {r.Pointer} {}
+        ref (ref &&r) noexcept : Pointer {r.Pointer} {
+            r.Pointer = nullptr;
+        }
+
+        template <typename Y> requires std::is_convertible_v<Y *, X *>
+        ref (const ref<Y> &r) : ref {static_cast<X *> (r.Pointer)} {}
+
+        template <typename Y> requires std::is_convertible_v<Y *, X *>
+        ref (ref<Y> &&r) noexcept : Pointer {r.Pointer} {
+            r.Pointer = nullptr;
+        }
+
+        ~ref () {
+            if (Pointer != nullptr && Pointer->release ()) delete Pointer;
+        }
+
+        ref &operator = (ref r) noexcept {
+            std::swap (Pointer, r.Pointer);
+            return *this;
+        }
+
+        X *get () const {
+            return Pointer;
+        }
+
+        X &operator * () const {
+            return *Pointer;
+        }
+
+        X *operator -> () const {
+            return Pointer;
+        }
+
+        explicit operator bool () const {
+            return Pointer != nullptr;
+        }
+
+        template <typename Y> bool operator == (const ref<Y> &r) const {
+            return Pointer == r.get ();
+        }
+
+        bool operator == (std::nullptr_t) const {
+            return Pointer == nullptr;
+        }
+
+    private:
+        X *Pointer;
+
+        template <typename Y> friend struct ref;
+    };
+
+    template <typename X, typename... Args> ref<X> inline make_ref (Args &&...args) {
+        return ref<X> {new X (std::forward<Args> (args)...)};
+    }
+
+    template <typename X, typename Y> ref<X> inline dynamic_ref_cast (const ref<Y> &r) {
+        return ref<X> {dynamic_cast<X *> (r.get ())};
+    }
+
+    template <typename X, typename Y> ref<X> inline static_ref_cast (const ref<Y> &r) {
+        return ref<X> {static_cast<X *> (r.get ())};
+    }
+
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef NODE_REWRITE
+#define NODE_REWRITE
+
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include "environment.hpp"
+
+namespace Diophant {
+
+    // Simplification of symbolic expressions by rewrite rules.
+    //
+    // The left side of a rule is a pattern in which every symbol that does
+    // not stand for a value is a variable that matches any subexpression,
+    // except that a symbol at the head of an application matches only
+    // itself, so that a rule for f x says nothing about g x.
+    // Rules are kept in a discrimination tree: the pattern is flattened into
+    // the sequence of heads that a preorder traversal visits, with a wildcard
+    // for each variable, and these sequences are stored in a trie. To find the
+    // rules that might match an expression, we walk the expression and the
+    // trie together, following both the branch for the head of the current
+    // subexpression and the wildcard branch, which skips it. The work done
+    // depends on the expression and on the rules that could match it, but
+    // not on how many rules there are in total.
+    struct rewriter {
+
+        // Add a rule. Symbols that are bound to values in vars are replaced
+        // by those values; the rest are variables. Returns the two sides of
+        // the rule as they were added.
+        std::pair<ref<const expression>, ref<const expression>> add (value left, value right, const scope &vars);
+
+        // add a rule in which every symbol that is not at the head of an application is a variable.
+        void add (value left, value right);
+
+        // Rewrite an expression until no rule applies, innermost first.
+        // Normal forms are remembered until the rules change or the
+        // generation of the memo of vars changes.
+        value normalize (value, const scope &vars);
+
+        size_t size () const {
+            return Rules.size ();
+        }
+
+        // the maximum number of rewrites in one call to normalize, after
+        // which we assume that the rules do not terminate.
+        static constexpr size_t MaxSteps = 100000;
+
+        // the maximum number of normal forms that are remembered.
+        static constexpr size_t MaxMemo = 1 << 16;
+
+    private:
+        struct rule {
+            value Left;
+            value Right;
+            std::set<data::string> Variables;
+        };
+
+        struct branch {
+            std::unordered_map<uint64, std::unique_ptr<branch>> Next;
+            std::unique_ptr<branch> Any;
+            std::vector<size_t> Rules;
+        };
+
+        std::vector<rule> Rules;
+        branch Root;
+
+        // normal forms by structural hash.
+        std::unordered_map<uint64, std::vector<std::pair<ref<const expression>, ref<const expression>>>> Memo;
+        size_t Memoized {0};
+        uint64 Generation {0};
+
+        void candidates (const branch &, std::vector<ref<const expression>> &, std::vector<size_t> &) const;
+
+        value normalize (value, const scope &vars, size_t &steps);
+        value remembered (value) const;
+        void remember (value, value);
+    };
+
+    // builtin algebraic identities and distribution.
+    void add_standard_rules (rewriter &);
+
+}
+
+#endif
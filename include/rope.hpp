@@ -0,0 +1,60 @@
+#ifndef NODE_ROPE
+#define NODE_ROPE
+
+#include <functional>
+#include <ostream>
+#include <string_view>
+#include "types.hpp"
+
+namespace Diophant {
+    using namespace data;
+
+    // An immutable string which shares its contents with the strings that it
+    // is made from instead of copying them. A rope is either a piece of text
+    // or the concatenation of two ropes, which are kept balanced as in an AVL
+    // tree, so that concatenation takes time logarithmic in the length of
+    // the result. Short pieces are copied together, which is faster than
+    // making another node.
+    struct rope {
+        rope () : Root {nullptr} {}
+        explicit rope (const data::string &);
+        explicit rope (ptr<const data::string>);
+
+        size_t size () const;
+
+        bool empty () const {
+            return size () == 0;
+        }
+
+        rope operator + (const rope &) const;
+
+        bool operator == (const rope &) const;
+
+        // the pieces of the rope, in order.
+        void each (const std::function<void (std::string_view)> &) const;
+
+        // the same value as hash_bytes of the flattened string.
+        uint64 hash () const;
+
+        data::string flatten () const;
+
+        std::ostream &write (std::ostream &) const;
+
+        // pieces up to this size are copied together when they are concatenated.
+        static constexpr size_t Short = 64;
+
+        struct node;
+
+    private:
+        ptr<const node> Root;
+        rope (ptr<const node> r) : Root {r} {}
+    };
+
+    // The one shared copy of a string. Strings stay in the table only for
+    // as long as they are in use, and this may be called from any thread,
+    // though threads that intern strings with the same hash take turns.
+    ptr<const data::string> intern (std::string_view);
+
+}
+
+#endif
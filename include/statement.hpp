@@ -0,0 +1,40 @@
+#ifndef NODE_STATEMENT
+#define NODE_STATEMENT
+
+#include <functional>
+#include <vector>
+#include "types.hpp"
+
+namespace Diophant {
+    using namespace data;
+
+    // The statement that the current thread is evaluating, for as long as
+    // it exists. A builtin that keeps something for the rest of the
+    // statement, such as a query that it has sent ahead, can ask to be told
+    // when the statement is over, whether it returned or threw.
+    struct statement {
+        statement ();
+        ~statement ();
+        statement (const statement &) = delete;
+        statement &operator = (const statement &) = delete;
+
+        // a number that is different for every statement, or zero if the
+        // thread is not evaluating a statement.
+        static uint64 current ();
+
+        // Call f when the current statement is over, in the reverse order
+        // in which functions were given. f must not throw. If there is no
+        // statement, f is called now.
+        static void finally (std::function<void ()> f);
+
+    private:
+        uint64 Number;
+        std::vector<std::function<void ()>> Finally;
+        statement *Previous;
+
+        static thread_local statement *Current;
+    };
+
+}
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef NODE_STATS
+#define NODE_STATS
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include "types.hpp"
+
+// Statistics about what the evaluator is doing. Everything here is only
+// recorded if the program is built with NODE_STATISTICS defined, otherwise
+// the functions below are empty and compile away entirely.
+namespace Diophant::stats {
+    using namespace data;
+
+#ifdef NODE_STATISTICS
+    constexpr bool enabled = true;
+#else
+    constexpr bool enabled = false;
+#endif
+
+    // every type of expression node.
+    enum class node : uint8 {
+        boolean,
+        rational,
+        symbol,
+        string,
+        list,
+        object,
+        part,
+        apply,
+        negate,
+        boolean_not,
+        plus,
+        minus,
+        times,
+        power,
+        divide,
+        equal,
+        unequal,
+        greater_equal,
+        less_equal,
+        greater,
+        less,
+        boolean_and,
+        boolean_or,
+        arrow,
+        intuitionistic_and,
+        intuitionistic_or,
+        intuitionistic_implies,
+        polynomial,
+        builtin,
+        error,
+        modular,
+        bytes,
+        count
+    };
+
+    const char *name (node);
+
+    // counts of durations in buckets of powers of two, starting at one microsecond.
+    struct histogram {
+        static constexpr size_t Buckets = 24;
+
+        std::atomic<uint64> Count[Buckets + 1] {};
+        std::atomic<uint64> Nanoseconds {0};
+
+        void record (std::chrono::nanoseconds);
+
+        // upper bound of bucket i in nanoseconds.
+        static constexpr uint64 bound (size_t i) {
+            return uint64 {1024} << i;
+        }
+    };
+
+    struct counters {
+        std::atomic<uint64> Evaluations[size_t (node::count)] {};
+        std::atomic<uint64> Allocated {0};
+        std::atomic<uint64> Freed {0};
+        std::atomic<uint64> Numbers {0};
+        histogram Parse;
+        histogram Evaluate;
+    };
+
+    counters &get ();
+
+    void inline evaluated (node n) {
+        if constexpr (enabled) get ().Evaluations[size_t (n)].fetch_add (1, std::memory_order_relaxed);
+    }
+
+    void inline allocated () {
+        if constexpr (enabled) get ().Allocated.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    void inline freed () {
+        if constexpr (enabled) get ().Freed.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    // a number was made, which is usually the result of an operation on big numbers.
+    void inline number () {
+        if constexpr (enabled) get ().Numbers.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    // Records the time between its construction and destruction in one of
+    // the histograms of the counters, which are not touched if statistics
+    // are disabled.
+    struct timer {
+        using clock = std::chrono::steady_clock;
+
+        histogram *Histogram;
+        clock::time_point Start;
+
+        timer (histogram counters::*h) {
+            if constexpr (enabled) {
+                Histogram = &(get ().*h);
+                Start = clock::now ();
+            }
+        }
+
+        ~timer () {
+            if constexpr (enabled) Histogram->record (clock::now () - Start);
+        }
+    };
+
+    // human-readable output for the REPL.
+    std::ostream &write (std::ostream &);
+
+    // Prometheus text exposition format.
+    std::ostream &write_prometheus (std::ostream &);
+
+}
+
+#endif
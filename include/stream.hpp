@@ -0,0 +1,30 @@
+#ifndef NODE_STREAM
+#define NODE_STREAM
+
+#include <ostream>
+#include "postgres.hpp"
+
+namespace Cosmos {
+
+    // Evaluate an expression for every row returned by a query. Each column
+    // of the result is bound to the symbol of the same name, and every value
+    // must be a number or null. A null is undefined, as is anything computed
+    // from it, and undefined results are null as well. Rows are streamed
+    // from the server with COPY, so the whole result is never held in
+    // memory at once.
+    //
+    // If into is given, the results are copied into that table, which must
+    // have a single column. Results are copied as they would be written, such
+    // as 2/3, so the column must be text unless every result is an integer.
+    // Otherwise they are written to results, one per line, in order.
+    //
+    // Rows are read, evaluated and written on three threads which pass
+    // batches of rows from one to the next. At most a few batches are
+    // waiting between any two of them, so memory does not grow with the
+    // size of the result.
+    void stream (const postgres_URL &, const string &query, const string &expression,
+        const maybe<string> &into, std::ostream &results);
+
+}
+
+#endif
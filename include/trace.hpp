@@ -0,0 +1,85 @@
+#ifndef NODE_TRACE
+#define NODE_TRACE
+
+#include <atomic>
+#include <array>
+#include <string_view>
+#include <ostream>
+#include "types.hpp"
+
+// Tracing of evaluation and parsing, for finding out which part of a
+// statement is slow. Events are recorded in a ring buffer belonging to
+// the thread that produced them and can be written out in the Chrome
+// trace format, which can be opened in chrome://tracing or Perfetto.
+//
+// Tracing is compiled in if NODE_TRACING is defined. It must still be
+// turned on at run time; until then, recording an event costs a single
+// branch on a flag that is almost never set.
+namespace Diophant::trace {
+    using namespace data;
+
+#ifdef NODE_TRACING
+    constexpr bool compiled = true;
+#else
+    constexpr bool compiled = false;
+#endif
+
+    extern std::atomic<bool> Enabled;
+
+    bool inline active () {
+        if constexpr (compiled) return Enabled.load (std::memory_order_relaxed);
+        else return false;
+    }
+
+    void enable ();
+    void disable ();
+
+    struct event {
+        uint64 Nanoseconds;
+        std::string_view Name;
+        char Phase;
+    };
+
+    // There is only ever one writer, the thread that owns the buffer, so
+    // recording an event does not need a lock. Once the buffer is full,
+    // the oldest events are overwritten.
+    struct ring {
+        static constexpr size_t Size = 1 << 16;
+
+        uint32 Thread;
+        std::atomic<uint64> Next {0};
+        std::array<event, Size> Events;
+
+        ring (uint32 thread) : Thread {thread} {}
+
+        void record (std::string_view name, char phase);
+    };
+
+    // the ring buffer for the current thread.
+    ring &local ();
+
+    // records the beginning and end of something.
+    struct scope {
+        std::string_view Name;
+        bool Active;
+
+        scope (std::string_view name) : Active {active ()} {
+            if (Active) {
+                Name = name;
+                local ().record (Name, 'B');
+            }
+        }
+
+        ~scope () {
+            if (Active) local ().record (Name, 'E');
+        }
+    };
+
+    // write all events in all buffers as Chrome trace JSON. This should
+    // be done while tracing is disabled, since events that are written
+    // concurrently may not be read correctly.
+    std::ostream &write (std::ostream &);
+
+}
+
+#endif
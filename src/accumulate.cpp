@@ -0,0 +1,46 @@
+#include "accumulate.hpp"
+
+namespace Diophant {
+
+    namespace {
+
+        // combine neighbors until only one is left.
+        template <typename F>
+        fraction tree (std::vector<fraction> &x, F f) {
+            while (x.size () > 1) {
+                size_t half = x.size () / 2;
+                for (size_t i = 0; i < half; i++) x[i] = f (x[2 * i], x[2 * i + 1]);
+                if (x.size () % 2 == 1) {
+                    x[half] = x.back ();
+                    half++;
+                }
+
+                x.erase (x.begin () + half, x.end ());
+            }
+
+            return x[0];
+        }
+
+    }
+
+    Q fraction::reduce () const {
+        return Q {Numerator} / math::nonzero<Q> {Q {Denominator}};
+    }
+
+    Q sum (std::vector<fraction> &&x) {
+        if (x.empty ()) return Q {Z {0}};
+        return tree (x, [] (const fraction &a, const fraction &b) -> fraction {
+            // integers and terms with a common denominator are common enough to be worth checking for.
+            if (a.Denominator == b.Denominator) return fraction {a.Numerator + b.Numerator, a.Denominator};
+            return fraction {a.Numerator * b.Denominator + b.Numerator * a.Denominator, a.Denominator * b.Denominator};
+        }).reduce ();
+    }
+
+    Q product (std::vector<fraction> &&x) {
+        if (x.empty ()) return Q {Z {1}};
+        return tree (x, [] (const fraction &a, const fraction &b) -> fraction {
+            return fraction {a.Numerator * b.Numerator, a.Denominator * b.Denominator};
+        }).reduce ();
+    }
+
+}
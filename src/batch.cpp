@@ -0,0 +1,425 @@
+#include <algorithm>
+#include <charconv>
+#include <limits>
+#include <sstream>
+
+#include "batch.hpp"
+#include "environment.hpp"
+
+namespace Diophant {
+
+    Q column::operator [] (size_t i) const {
+        return Exact ? Rationals[i] : Q {Z {Words[i]}};
+    }
+
+    void column::push_back (int64 x) {
+        if (!Undefined.empty ()) Undefined.push_back (0);
+        if (Exact) Rationals.push_back (Q {Z {x}});
+        else Words.push_back (x);
+    }
+
+    void column::push_undefined () {
+        Undefined.resize (size (), 0);
+        if (Exact) Rationals.push_back (Q {Z {0}});
+        else Words.push_back (0);
+        Undefined.push_back (1);
+    }
+
+    void column::push_back (const Q &q) {
+        if (!Undefined.empty ()) Undefined.push_back (0);
+        if (!Exact) {
+            // keep words if we can.
+            if (q.Denominator == 1 && q.Numerator >= Z {std::numeric_limits<int64>::min ()} &&
+                q.Numerator <= Z {std::numeric_limits<int64>::max ()}) {
+                Words.push_back (int64 (q.Numerator));
+                return;
+            }
+
+            promote ();
+        }
+
+        Rationals.push_back (q);
+    }
+
+    void column::promote () {
+        if (Exact) return;
+        Rationals.reserve (Words.size ());
+        for (int64 x : Words) Rationals.push_back (Q {Z {x}});
+        Words.clear ();
+        Exact = true;
+    }
+
+    void read_number (std::string_view x, column &c) {
+        int64 w;
+        auto [p, err] = std::from_chars (x.data (), x.data () + x.size (), w);
+        if (err == std::errc {} && p == x.data () + x.size ()) {
+            c.push_back (w);
+            return;
+        }
+
+        std::string s {x};
+
+        auto integer = [&s] (const std::string &digits) -> Z {
+            size_t sign = !digits.empty () && digits[0] == '-' ? 1 : 0;
+            if (digits.size () == sign || !std::all_of (digits.begin () + sign, digits.end (), [] (char d) {
+                return d >= '0' && d <= '9';
+            })) throw exception {} << "could not read number \"" << s << "\"";
+            return Z {digits};
+        };
+
+        if (size_t slash = s.find ('/'); slash != std::string::npos) {
+            Z d = integer (s.substr (slash + 1));
+            if (d == Z {0}) throw exception {} << "division by zero in \"" << s << "\"";
+            c.push_back (Q {integer (s.substr (0, slash))} / math::nonzero<Q> {Q {d}});
+            return;
+        }
+
+        if (size_t dot = s.find ('.'); dot != std::string::npos) {
+            std::string fraction = s.substr (dot + 1);
+            Z d {1};
+            for (size_t i = 0; i < fraction.size (); i++) d = d * Z {10};
+            c.push_back (Q {integer (s.substr (0, dot) + fraction)} / math::nonzero<Q> {Q {d}});
+            return;
+        }
+
+        c.push_back (Q {integer (s)});
+    }
+
+    void write_lines (std::string &out, const column &c) {
+        if (!c.Exact) {
+            char buffer[24];
+            for (size_t i = 0; i < c.Words.size (); i++) {
+                if (!c.defined (i)) out += "undefined";
+                else {
+                    auto [p, err] = std::to_chars (buffer, buffer + sizeof (buffer), c.Words[i]);
+                    out.append (buffer, p);
+                }
+
+                out.push_back ('\n');
+            }
+
+            return;
+        }
+
+        std::stringstream ss;
+        for (size_t i = 0; i < c.Rationals.size (); i++) {
+            const Q &q = c.Rationals[i];
+            if (!c.defined (i)) ss << "undefined";
+            else {
+                ss << q.Numerator;
+                if (q.Denominator != 1) ss << "/" << q.Denominator;
+            }
+
+            ss << "\n";
+        }
+
+        out += ss.str ();
+    }
+
+    namespace {
+
+        constexpr uint64 Max = uint64 (std::numeric_limits<int64>::max ());
+
+        // The values of a register for one batch. If they are words, Bound is
+        // at least the absolute value of every one of them, which tells us
+        // whether an operation on them could overflow without looking at them.
+        struct lane {
+            bool Exact {false};
+            uint64 Bound {0};
+            std::vector<int64> Words;
+            std::vector<Q> Rationals;
+            // as in a column, and empty unless some value is undefined.
+            std::vector<uint8> Undefined;
+
+            void promote () {
+                if (Exact) return;
+                Rationals.resize (Words.size ());
+                for (size_t i = 0; i < Words.size (); i++) Rationals[i] = Q {Z {Words[i]}};
+                Exact = true;
+            }
+        };
+
+        uint64 inline magnitude (int64 x) {
+            return x < 0 ? uint64 (0) - uint64 (x) : uint64 (x);
+        }
+
+        // bounds that are no more than Max, so that negation cannot overflow.
+        bool inline fits (uint64 bound) {
+            return bound <= Max;
+        }
+
+        void load (lane &r, const column &c, size_t begin, size_t n) {
+            if (c.Undefined.empty ()) r.Undefined.clear ();
+            else r.Undefined.assign (c.Undefined.begin () + begin, c.Undefined.begin () + begin + n);
+
+            if (c.Exact) {
+                r.Exact = true;
+                r.Rationals.assign (c.Rationals.begin () + begin, c.Rationals.begin () + begin + n);
+                return;
+            }
+
+            r.Exact = false;
+            r.Words.assign (c.Words.begin () + begin, c.Words.begin () + begin + n);
+
+            uint64 bound = 0;
+            for (int64 x : r.Words) bound = std::max (bound, magnitude (x));
+            r.Bound = bound;
+            if (!fits (bound)) r.promote ();
+        }
+
+        void constant (lane &r, const Q &q, size_t n) {
+            r.Undefined.clear ();
+            if (q.Denominator == 1 && q.Numerator >= -Z {int64 (Max)} && q.Numerator <= Z {int64 (Max)}) {
+                int64 x = int64 (q.Numerator);
+                r.Exact = false;
+                r.Words.assign (n, x);
+                r.Bound = magnitude (x);
+                return;
+            }
+
+            r.Exact = true;
+            r.Rationals.assign (n, q);
+        }
+
+        void negate (lane &r, const lane &a, size_t n) {
+            r.Undefined = a.Undefined;
+            if (!a.Exact) {
+                r.Exact = false;
+                r.Words.resize (n);
+                for (size_t i = 0; i < n; i++) r.Words[i] = -a.Words[i];
+                r.Bound = a.Bound;
+                return;
+            }
+
+            r.Exact = true;
+            r.Rationals.resize (n);
+            for (size_t i = 0; i < n; i++) r.Rationals[i] = -a.Rationals[i];
+        }
+
+        // the exact operands for an operation that cannot be done on words.
+        const std::vector<Q> &exact (const lane &a, lane &copy) {
+            if (a.Exact) return a.Rationals;
+            copy = a;
+            copy.promote ();
+            return copy.Rationals;
+        }
+
+        // a value is undefined if either operand is.
+        void undefined (lane &r, const lane &a, const lane &b, size_t n) {
+            if (a.Undefined.empty () && b.Undefined.empty ()) {
+                r.Undefined.clear ();
+                return;
+            }
+
+            r.Undefined.assign (n, 0);
+            uint8 *z = r.Undefined.data ();
+            if (!a.Undefined.empty ()) for (size_t i = 0; i < n; i++) z[i] |= a.Undefined[i];
+            if (!b.Undefined.empty ()) for (size_t i = 0; i < n; i++) z[i] |= b.Undefined[i];
+        }
+
+        // The loops over words have no branches in them, so that the compiler
+        // can turn them into vector instructions.
+        template <typename W, typename E>
+        void binary (lane &r, const lane &a, const lane &b, size_t n, bool words, uint64 bound, W w, E e) {
+            undefined (r, a, b, n);
+            if (words) {
+                r.Exact = false;
+                r.Words.resize (n);
+                const int64 *x = a.Words.data ();
+                const int64 *y = b.Words.data ();
+                int64 *z = r.Words.data ();
+                for (size_t i = 0; i < n; i++) z[i] = w (x[i], y[i]);
+                r.Bound = bound;
+                return;
+            }
+
+            lane ca, cb;
+            const std::vector<Q> &x = exact (a, ca);
+            const std::vector<Q> &y = exact (b, cb);
+            r.Exact = true;
+            r.Rationals.resize (n);
+            for (size_t i = 0; i < n; i++) r.Rationals[i] = e (x[i], y[i]);
+        }
+
+        // A row with a divisor of zero is undefined rather than an error, so
+        // that one bad row does not cost any more than a good one.
+        void divide (lane &r, const lane &a, const lane &b, size_t n) {
+            undefined (r, a, b, n);
+
+            lane ca, cb;
+            const std::vector<Q> &x = exact (a, ca);
+            const std::vector<Q> &y = exact (b, cb);
+            r.Exact = true;
+            r.Rationals.resize (n);
+            for (size_t i = 0; i < n; i++) {
+                if (y[i].Numerator != 0) {
+                    r.Rationals[i] = x[i] / math::nonzero<Q> {y[i]};
+                    continue;
+                }
+
+                if (r.Undefined.empty ()) r.Undefined.assign (n, 0);
+                r.Undefined[i] = 1;
+                r.Rationals[i] = Q {Z {0}};
+            }
+        }
+
+    }
+
+    program::program (value v, const std::vector<data::string> &columns, const scope &vars) :
+        Columns {columns.size ()}, Used (columns.size (), false) {
+        compile (v, columns, vars);
+        Compiled.clear ();
+    }
+
+    uint32 program::emit (value v, instruction i) {
+        Code.push_back (i);
+        uint32 r = uint32 (Code.size () - 1);
+        if (v != nullptr) Compiled[v->hash ()].emplace_back (v, r);
+        return r;
+    }
+
+    uint32 program::compile (value v, const std::vector<data::string> &columns, const scope &vars) {
+        if (v == nullptr) throw exception {} << "cannot compile null";
+
+        if (auto c = Compiled.find (v->hash ()); c != Compiled.end ())
+            for (const auto &[x, r] : c->second) if (identical (x, v)) return r;
+
+        switch (v->kind ()) {
+            case stats::node::rational: {
+                Constants.push_back (*rational_value (v));
+                return emit (v, instruction {op::constant, uint32 (Constants.size () - 1), 0});
+            }
+
+            case stats::node::symbol: {
+                data::string name = v->write ();
+                if (auto c = std::find (columns.begin (), columns.end (), name); c != columns.end ()) {
+                    Used[c - columns.begin ()] = true;
+                    return emit (v, instruction {op::load, uint32 (c - columns.begin ()), 0});
+                }
+
+                auto q = rational_value (vars.evaluate (name));
+                if (!q) throw exception {} << "cannot compile " << name << " because it is neither a column nor a number";
+                Constants.push_back (*q);
+                return emit (v, instruction {op::constant, uint32 (Constants.size () - 1), 0});
+            }
+
+            case stats::node::negate: {
+                uint32 a = compile (v->child (0), columns, vars);
+                return emit (v, instruction {op::negate, a, 0});
+            }
+
+            case stats::node::plus:
+            case stats::node::minus:
+            case stats::node::times:
+            case stats::node::divide: {
+                uint32 a = compile (v->child (0), columns, vars);
+                uint32 b = compile (v->child (1), columns, vars);
+                op o = v->kind () == stats::node::plus ? op::plus :
+                    v->kind () == stats::node::minus ? op::minus :
+                    v->kind () == stats::node::times ? op::times : op::divide;
+                return emit (v, instruction {o, a, b});
+            }
+
+            default: throw exception {} << "cannot compile " << v << " for batch evaluation";
+        }
+    }
+
+    column program::operator () (const std::vector<const column *> &columns) const {
+        size_t rows = 1;
+        for (size_t j = 0; j < columns.size (); j++) if (j < Columns && Used[j]) {
+            rows = columns[j]->size ();
+            break;
+        }
+
+        return run (columns, rows);
+    }
+
+    column program::run (const std::vector<const column *> &columns, size_t rows) const {
+        if (columns.size () != Columns) throw exception {} << "expected " << Columns << " columns but got " << columns.size ();
+
+        for (size_t j = 0; j < Columns; j++)
+            if (Used[j] && (columns[j] == nullptr || columns[j]->size () != rows))
+                throw exception {} << "columns are not all the same size";
+
+        column result {};
+        std::vector<lane> registers (Code.size ());
+
+        for (size_t begin = 0; begin < rows; begin += Batch) {
+            size_t n = std::min (Batch, rows - begin);
+
+            for (size_t k = 0; k < Code.size (); k++) {
+                const instruction &i = Code[k];
+                lane &r = registers[k];
+                switch (i.Op) {
+                    case op::load: {
+                        load (r, *columns[i.A], begin, n);
+                        break;
+                    }
+
+                    case op::constant: {
+                        constant (r, Constants[i.A], n);
+                        break;
+                    }
+
+                    case op::negate: {
+                        negate (r, registers[i.A], n);
+                        break;
+                    }
+
+                    case op::plus: {
+                        const lane &a = registers[i.A];
+                        const lane &b = registers[i.B];
+                        bool words = !a.Exact && !b.Exact && a.Bound <= Max - b.Bound;
+                        binary (r, a, b, n, words, a.Bound + b.Bound,
+                            [] (int64 x, int64 y) { return x + y; },
+                            [] (const Q &x, const Q &y) { return x + y; });
+                        break;
+                    }
+
+                    case op::minus: {
+                        const lane &a = registers[i.A];
+                        const lane &b = registers[i.B];
+                        bool words = !a.Exact && !b.Exact && a.Bound <= Max - b.Bound;
+                        binary (r, a, b, n, words, a.Bound + b.Bound,
+                            [] (int64 x, int64 y) { return x - y; },
+                            [] (const Q &x, const Q &y) { return x - y; });
+                        break;
+                    }
+
+                    case op::times: {
+                        const lane &a = registers[i.A];
+                        const lane &b = registers[i.B];
+                        bool words = !a.Exact && !b.Exact && (a.Bound == 0 || b.Bound <= Max / a.Bound);
+                        binary (r, a, b, n, words, a.Bound * (words ? b.Bound : 0),
+                            [] (int64 x, int64 y) { return x * y; },
+                            [] (const Q &x, const Q &y) { return x * y; });
+                        break;
+                    }
+
+                    // division is always exact.
+                    case op::divide: {
+                        divide (r, registers[i.A], registers[i.B], n);
+                        break;
+                    }
+                }
+            }
+
+            const lane &out = registers.back ();
+            size_t before = result.size ();
+            if (!out.Exact && !result.Exact) result.Words.insert (result.Words.end (), out.Words.begin (), out.Words.begin () + n);
+            else if (!out.Exact) for (size_t i = 0; i < n; i++) result.push_back (out.Words[i]);
+            else {
+                result.promote ();
+                result.Rationals.insert (result.Rationals.end (), out.Rationals.begin (), out.Rationals.begin () + n);
+            }
+
+            if (!out.Undefined.empty ()) {
+                result.Undefined.resize (before, 0);
+                result.Undefined.insert (result.Undefined.end (), out.Undefined.begin (), out.Undefined.begin () + n);
+            } else if (!result.Undefined.empty ()) result.Undefined.resize (result.size (), 0);
+        }
+
+        return result;
+    }
+
+}
@@ -0,0 +1,423 @@
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <unistd.h>
+
+#include "benchmark.hpp"
+#include "calc.hpp"
+#include "environment.hpp"
+#include "batch.hpp"
+#include "stats.hpp"
+
+namespace Cosmos {
+
+    namespace {
+
+        using clock = std::chrono::steady_clock;
+
+        // a family of inputs whose size is given by a parameter n.
+        struct family {
+            const char *Name;
+
+            // the largest growth exponent we accept for time and memory.
+            double Exponent;
+
+            std::vector<size_t> Sizes;
+
+            // make any definitions that are needed for an input of size n
+            // and return the statement to be measured.
+            std::function<string (session &, size_t)> Prepare;
+        };
+
+        struct measurement {
+            size_t Size;
+            double Seconds;
+            double Bytes;
+        };
+
+        // Bytes in use on the heap. mallinfo2 is only in glibc, so elsewhere
+        // we count the expression nodes that are still alive, which we only
+        // know if the program is built with statistics.
+        size_t heap () {
+#ifdef __GLIBC__
+            return mallinfo2 ().uordblks;
+#else
+            auto &c = Diophant::stats::get ();
+            return c.Allocated.load (std::memory_order_relaxed) - c.Freed.load (std::memory_order_relaxed);
+#endif
+        }
+
+        string repeat (const string &first, const string &next, size_t n) {
+            std::stringstream ss;
+            ss << first;
+            for (size_t i = 1; i < n; i++) ss << next;
+            return ss.str ();
+        }
+
+        measurement measure (const family &f, size_t n) {
+            size_t before = heap ();
+
+            measurement m {n, std::numeric_limits<double>::infinity (), 0};
+
+            session s {};
+            string statement = f.Prepare (s, n);
+
+            // Memory is what the session keeps in order to hold a definition
+            // of the statement, or, if the statement is a definition, what it
+            // keeps after making it, since a definition cannot be defined.
+            if (statement.find (":=") != string::npos) s (statement);
+            else s (string {"benchmark_result := "} + statement);
+            m.Bytes = std::max (double (heap ()) - double (before), 1.);
+
+            // take the best of several trials, each of which runs long enough to be measured.
+            for (int trial = 0; trial < 3; trial++) {
+                size_t runs = 0;
+                auto start = clock::now ();
+                clock::duration elapsed;
+
+                do {
+                    s (statement);
+                    runs++;
+                    elapsed = clock::now () - start;
+                } while (elapsed < std::chrono::milliseconds {20});
+
+                m.Seconds = std::min (m.Seconds, std::chrono::duration<double> (elapsed).count () / runs);
+            }
+
+            return m;
+        }
+
+        // least squares fit of log y against log n.
+        double exponent (const std::vector<measurement> &ms, double measurement::*y) {
+            double sx = 0, sy = 0, sxx = 0, sxy = 0;
+            for (const auto &m : ms) {
+                double lx = std::log (double (m.Size));
+                double ly = std::log (m.*y);
+                sx += lx;
+                sy += ly;
+                sxx += lx * lx;
+                sxy += lx * ly;
+            }
+
+            double k = double (ms.size ());
+            return (k * sxy - sx * sy) / (k * sxx - sx * sx);
+        }
+
+        const std::vector<family> &families () {
+            static std::vector<family> Families {
+                {"sum", 1.3, {128, 256, 512, 1024}, [] (session &, size_t n) -> string {
+                    return repeat ("1", " + 1", n);
+                }},
+                {"difference", 1.3, {128, 256, 512, 1024}, [] (session &, size_t n) -> string {
+                    return repeat ("1", " - 1", n);
+                }},
+                {"nesting", 1.3, {32, 64, 128, 256}, [] (session &, size_t n) -> string {
+                    return repeat ("(1", " + (1", n) + string (n - 1, ')') + ")";
+                }},
+                // strings are ropes, so the string built so far is not copied.
+                {"concatenation", 1.3, {500, 1000, 2000, 4000}, [] (session &, size_t n) -> string {
+                    return repeat ("\"abcdefghijklmnopqrstuvwxyz\"", " + \"abcdefghijklmnopqrstuvwxyz\"", n);
+                }},
+                // every operand is known to be a boolean before we evaluate.
+                {"conjunction", 1.3, {128, 256, 512, 1024}, [] (session &, size_t n) -> string {
+                    return repeat ("true", " && true", n);
+                }},
+                // a list is inverted with one inversion and a few multiplications per element.
+                {"inversion", 1.3, {500, 1000, 2000, 4000}, [] (session &, size_t n) -> string {
+                    return "invert " + repeat ("[modp 7", ", modp 7", n) + "]";
+                }},
+                {"hashing", 1.3, {1000, 2000, 4000, 8000}, [] (session &, size_t n) -> string {
+                    return "sha256 " + repeat ("[0x00", ", 0x00", n) + "]";
+                }},
+                {"list", 1.3, {1000, 2000, 4000, 8000}, [] (session &, size_t n) -> string {
+                    return repeat ("[1", ", 1", n) + "]";
+                }},
+                {"object", 1.3, {250, 500, 1000, 2000}, [] (session &, size_t n) -> string {
+                    std::stringstream ss;
+                    ss << "{a0: 1";
+                    for (size_t i = 1; i < n; i++) ss << ", a" << i << ": 1";
+                    ss << "}@a" << (n - 1);
+                    return ss.str ();
+                }},
+                {"chain", 1.3, {64, 128, 256, 512}, [] (session &s, size_t n) -> string {
+                    s ("x0 := 1");
+                    for (size_t i = 1; i < n; i++) {
+                        std::stringstream ss;
+                        ss << "x" << i << " := x" << (i - 1);
+                        s (ss.str ());
+                    }
+
+                    std::stringstream ss;
+                    ss << "x" << (n - 1);
+                    return ss.str ();
+                }},
+                // redefining p costs nothing more when other definitions depend on r.
+                {"redefinition", 1.3, {1000, 2000, 4000, 8000}, [] (session &s, size_t n) -> string {
+                    s ("p := 1");
+                    s ("r := 1");
+                    for (size_t i = 0; i < n; i++) {
+                        std::stringstream ss;
+                        ss << "d" << i << " := r + " << i;
+                        s (ss.str ());
+                        s (ss.str ().substr (0, ss.str ().find (' ')));
+                    }
+
+                    return "p := 2";
+                }},
+                // GMP parses and multiplies in better than quadratic time.
+                {"bit width", 1.7, {2000, 4000, 8000, 16000}, [] (session &, size_t n) -> string {
+                    string digits (n, '7');
+                    return digits + " * " + digits;
+                }}
+            };
+
+            return Families;
+        }
+
+        // Statements evaluated per second by each of t threads, each with its
+        // own session over a shared environment. Sessions do not lock when
+        // they read the shared environment, so this should not go down much
+        // as t goes up, as long as there are enough cores.
+        double throughput (ptr<Diophant::environment> shared, size_t t) {
+            std::vector<size_t> counts (t, 0);
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < t; i++) threads.emplace_back ([&shared, &counts, i] () {
+                session s {shared};
+                auto start = clock::now ();
+                size_t runs = 0;
+                do {
+                    s ("a * a + a - b");
+                    runs++;
+                } while (clock::now () - start < std::chrono::milliseconds {100});
+                counts[i] = runs;
+            });
+
+            for (auto &x : threads) x.join ();
+
+            size_t total = 0;
+            for (size_t c : counts) total += c;
+            return double (total) / .1 / double (t);
+        }
+
+        // Wall time from starting the program in one-shot mode until it has
+        // written its result. Returns nothing if it could not be run.
+        maybe<double> startup () {
+            std::array<char, 4096> path {};
+            ssize_t size = readlink ("/proc/self/exe", path.data (), path.size () - 1);
+            if (size <= 0) return {};
+
+            string command = string {path.data (), size_t (size)} + " --eval \"1 + 1\"";
+            auto start = clock::now ();
+            FILE *p = popen (command.c_str (), "r");
+            if (p == nullptr) return {};
+
+            std::array<char, 64> out {};
+            bool read = fgets (out.data (), out.size (), p) != nullptr;
+            double elapsed = std::chrono::duration<double> (clock::now () - start).count ();
+            if (pclose (p) != 0 || !read || string {out.data ()} != "2\n") return {};
+            return elapsed;
+        }
+
+        // rows per second for a * b + c over columns of small integers.
+        double batch_throughput (size_t rows) {
+            std::vector<Diophant::column> columns (3);
+            for (size_t i = 0; i < rows; i++)
+                for (size_t j = 0; j < 3; j++) columns[j].push_back (int64 ((i * 7919 + j * 104729) % 2000001) - 1000000);
+
+            session s {};
+            auto p = s.compile ("a * b + c", {"a", "b", "c"});
+
+            double best = std::numeric_limits<double>::infinity ();
+            for (int trial = 0; trial < 3; trial++) {
+                auto start = clock::now ();
+                auto result = p ({&columns[0], &columns[1], &columns[2]});
+                best = std::min (best, std::chrono::duration<double> (clock::now () - start).count ());
+                if (result.size () != rows) return 0;
+            }
+
+            return double (rows) / best;
+        }
+
+        // rows per second for a / b, where b is zero in every nth row, or in none if n is zero.
+        double division_throughput (size_t rows, size_t n) {
+            std::vector<Diophant::column> columns (2);
+            for (size_t i = 0; i < rows; i++) {
+                columns[0].push_back (int64 (i % 1000) + 1);
+                columns[1].push_back (n != 0 && i % n == 0 ? int64 {0} : int64 (i % 997) + 1);
+            }
+
+            session s {};
+            auto p = s.compile ("a / b", {"a", "b"});
+
+            double best = std::numeric_limits<double>::infinity ();
+            for (int trial = 0; trial < 3; trial++) {
+                auto start = clock::now ();
+                auto result = p ({&columns[0], &columns[1]});
+                best = std::min (best, std::chrono::duration<double> (clock::now () - start).count ());
+                if (result.size () != rows) return 0;
+            }
+
+            return double (rows) / best;
+        }
+
+        // rows per second for the same formula as a statement for each row.
+        double statement_throughput (size_t rows) {
+            session s {};
+            auto start = clock::now ();
+            for (size_t i = 0; i < rows; i++) {
+                std::stringstream ss;
+                ss << (i * 7919 % 2000001) << " * " << ((i * 7919 + 104729) % 2000001) << " + " << ((i * 7919 + 209458) % 2000001);
+                s (ss.str ());
+            }
+
+            return double (rows) / std::chrono::duration<double> (clock::now () - start).count ();
+        }
+
+        // A list of n elements, since the parser goes no deeper into a long
+        // list than into a short one, unlike a long sum.
+        string list_of (size_t n, const std::function<string (size_t)> &element) {
+            std::stringstream ss;
+            ss << "[";
+            for (size_t i = 0; i < n; i++) ss << (i == 0 ? "" : ", ") << element (i);
+            ss << "]";
+            return ss.str ();
+        }
+
+        // seconds to read an expression without evaluating it.
+        double parse_time (const string &expression) {
+            session s {};
+            double best = std::numeric_limits<double>::infinity ();
+            for (int trial = 0; trial < 3; trial++) {
+                auto start = clock::now ();
+                s.read (expression);
+                best = std::min (best, std::chrono::duration<double> (clock::now () - start).count ());
+            }
+
+            return best;
+        }
+
+        struct shape {
+            const char *Name;
+            std::function<string (size_t)> Element;
+        };
+
+        const std::vector<shape> &shapes () {
+            static std::vector<shape> Shapes {
+                {"numbers", [] (size_t i) -> string {
+                    return std::to_string (i * 7919);
+                }},
+                {"strings", [] (size_t i) -> string {
+                    return "\"string number " + std::to_string (i) + "\"";
+                }},
+                {"arithmetic", [] (size_t i) -> string {
+                    return "a * " + std::to_string (i) + " + (b - c) / 2 ^ 3";
+                }},
+                {"objects", [] (size_t i) -> string {
+                    return "{x: " + std::to_string (i) + ", y: [z, -1]}@x";
+                }},
+                {"calls", [] (size_t i) -> string {
+                    return "f " + std::to_string (i) + " (g x) y";
+                }}
+            };
+
+            return Shapes;
+        }
+
+    }
+
+    bool benchmark (std::ostream &o) {
+        bool passed = true;
+
+        o << std::setprecision (3);
+        o << "\nscaling:" << std::endl;
+        for (const family &f : families ()) {
+            std::vector<measurement> ms;
+            o << "\n " << f.Name << std::endl;
+            for (size_t n : f.Sizes) {
+                ms.push_back (measure (f, n));
+                o << "   n = " << std::setw (6) << n << ": " << ms.back ().Seconds * 1e6 << "us, "
+                    << size_t (ms.back ().Bytes) << " bytes" << std::endl;
+            }
+
+            double time = exponent (ms, &measurement::Seconds);
+            double memory = exponent (ms, &measurement::Bytes);
+            bool ok = time <= f.Exponent && memory <= f.Exponent;
+            passed = passed && ok;
+
+            o << "   time ~ n^" << time << ", memory ~ n^" << memory
+                << " (limit n^" << f.Exponent << "): " << (ok ? "ok" : "FAILED") << std::endl;
+        }
+
+        // reading should take time in proportion to the length of the input.
+        o << "\nparsing:" << std::endl;
+        for (const shape &x : shapes ()) {
+            std::vector<measurement> ms;
+            for (size_t n = 1 << 12; n <= 1 << 15; n *= 2) {
+                string input = list_of (n, x.Element);
+                ms.push_back (measurement {n, parse_time (input), double (input.size ())});
+            }
+
+            double time = exponent (ms, &measurement::Seconds);
+            bool ok = time <= 1.3;
+            passed = passed && ok;
+
+            o << "   " << x.Name << ": " << ms.back ().Bytes / ms.back ().Seconds / 1e6 << " MB per second for "
+                << size_t (ms.back ().Bytes) << " bytes, time ~ n^" << time << ": " << (ok ? "ok" : "FAILED") << std::endl;
+        }
+
+        o << "\nstartup to first result:" << std::endl;
+        maybe<double> fastest {};
+        for (int trial = 0; trial < 5; trial++)
+            if (auto t = startup (); t) fastest = fastest ? std::min (*fastest, *t) : *t;
+        if (fastest) o << "   " << *fastest * 1e3 << "ms" << std::endl;
+        else {
+            o << "   could not run node --eval: FAILED" << std::endl;
+            passed = false;
+        }
+
+        o << "\nbatch evaluation of a * b + c:" << std::endl;
+        o << "   columns: " << batch_throughput (1 << 20) << " rows per second" << std::endl;
+        o << "   statements: " << statement_throughput (1 << 12) << " rows per second" << std::endl;
+
+        // rows that have no value should cost no more than rows that do.
+        o << "\nbatch evaluation of a / b:" << std::endl;
+        double defined = division_throughput (1 << 18, 0);
+        double undefined = division_throughput (1 << 18, 2);
+        bool ok = undefined >= defined / 2;
+        passed = passed && ok;
+        o << "   no division by zero: " << defined << " rows per second" << std::endl;
+        o << "   half divisions by zero: " << undefined << " rows per second: " << (ok ? "ok" : "FAILED") << std::endl;
+
+        o << "\nconcurrent sessions:" << std::endl;
+        auto shared = std::make_shared<Diophant::environment> (Diophant::bindings {});
+        {
+            session s {shared};
+            s ("a := 3/7");
+            s ("b := 5/11");
+            s.publish ();
+        }
+
+        size_t cores = std::max (std::thread::hardware_concurrency (), 1u);
+        double single = 0;
+        for (size_t t = 1; t <= cores; t *= 2) {
+            double per_thread = throughput (shared, t);
+            if (t == 1) single = per_thread;
+            o << "   threads = " << std::setw (3) << t << ": " << per_thread << " statements per second per thread ("
+                << per_thread / single * 100 << "% of one thread)" << std::endl;
+        }
+
+        return passed;
+    }
+
+}
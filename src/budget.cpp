@@ -0,0 +1,65 @@
+#include <sstream>
+#include <gmp.h>
+
+#include "budget.hpp"
+
+namespace Diophant {
+
+    budget &budget::standard () {
+        static budget Standard {};
+        return Standard;
+    }
+
+    const char *name (resource r) {
+        switch (r) {
+            case resource::steps: return "steps";
+            case resource::nodes: return "nodes";
+            case resource::bytes: return "bytes";
+            case resource::time: return "milliseconds";
+            default: return "unknown";
+        }
+    }
+
+    budget_exceeded::budget_exceeded (resource r, uint64 limit) : Resource {r}, Limit {limit} {
+        std::stringstream ss;
+        ss << "evaluation exceeded its budget of " << limit << " " << name (r);
+        Message = ss.str ();
+    }
+
+    uint64 size_of (const Q &q) {
+        return (mpz_size (q.Numerator.MPZ) + mpz_size (q.Denominator.Value.MPZ)) * sizeof (mp_limb_t);
+    }
+
+    thread_local meter *meter::Current {nullptr};
+
+    meter::meter (const budget &b) : Limits {b}, Deadline {clock::now () + b.Time}, Previous {Current} {
+        Current = this;
+    }
+
+    meter::~meter () {
+        Current = Previous;
+    }
+
+    void meter::spend_step () {
+        Steps++;
+        if (Limits.Steps != 0 && Steps > Limits.Steps) throw budget_exceeded {resource::steps, Limits.Steps};
+        if (Limits.Time.count () != 0 && Steps % ClockInterval == 0 && clock::now () > Deadline)
+            throw budget_exceeded {resource::time, uint64 (Limits.Time.count ())};
+    }
+
+    void meter::spend_node () {
+        Nodes++;
+        if (Limits.Nodes != 0 && Nodes > Limits.Nodes) throw budget_exceeded {resource::nodes, Limits.Nodes};
+    }
+
+    void meter::spend_bytes (uint64 n) {
+        check_bytes (n);
+        Bytes += n;
+    }
+
+    void meter::check_bytes (uint64 n) const {
+        if (Limits.Bytes != 0 && (n > Limits.Bytes || Bytes > Limits.Bytes - n))
+            throw budget_exceeded {resource::bytes, Limits.Bytes};
+    }
+
+}
@@ -6,113 +6,47 @@
 #include <iostream>
 
 #include "calc.hpp"
-#include <data/numbers.hpp>
+#include "journal.hpp"
+#include "expression.hpp"
+#include "trace.hpp"
+#include "rewrite.hpp"
+#include "environment.hpp"
+#include "statement.hpp"
+#include "polynomial.hpp"
+#include "modular.hpp"
+#include "digest.hpp"
+#include "accumulate.hpp"
 #include <data/for_each.hpp>
 #include <map>
+#include <set>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <fstream>
+#include <algorithm>
+#include <limits>
 
 namespace Diophant {
 
     using namespace data;
 
-    struct expression;
-    using value = const ptr<const expression>;
-
-    struct expression : std::enable_shared_from_this<expression> {
-
-        static value null ();
-        static value boolean (bool b);
-        static value rational (const data::Q &q);
-        static value symbol (const data::string &x);
-        static value string (const data::string &str);
-        static value list (const data::list<value> &ls);
-        static value object (const data::list<data::entry<data::string, value>> &x);
-
-        static value apply (const value, const value);
-
-        static value negate (const value);
-        static value plus (const value, const value);
-        static value minus (const value, const value);
-        static value times (const value, const value);
-        static value power (const value, const value);
-        static value divide (const value, const value);
-
-        static value equal (const value, const value);
-        static value unequal (const value, const value);
-        static value greater_equal (const value, const value);
-        static value less_equal (const value, const value);
-        static value greater (const value, const value);
-        static value less (const value, const value);
-
-        static value boolean_not (const value);
-        static value boolean_and (const value, const value);
-        static value boolean_or (const value, const value);
-
-        static value arrow (const value, const value);
-
-        static value intuitionistic_and (const value, const value);
-        static value intuitionistic_or (const value, const value);
-        static value intuitionistic_implies (const value, const value);
-
-        virtual ~expression () {};
-
-        virtual std::ostream &write (std::ostream &) const = 0;
-
-        data::string write () const {
-            std::stringstream ss;
-            write (ss);
-            return ss.str ();
-        }
-
-        virtual uint32 precedence () const {
-            return 0;
-        }
-
-        virtual value evaluate (const std::map<data::string, value> &vars) const {
-            return this->shared_from_this ();
-        };
-
-        virtual value operator () (const value) const;
-        virtual value operator - () const;
-        virtual value operator ! () const;
-
-        virtual value operator + (const value) const;
-        virtual value operator - (const value) const;
-        virtual value operator * (const value) const;
-        virtual value operator / (const value) const;
-        virtual value operator ^ (const value) const;
-
-        virtual value operator == (const value) const;
-        virtual value operator != (const value) const;
-        virtual value operator <= (const value) const;
-        virtual value operator >= (const value) const;
-        virtual value operator < (const value) const;
-        virtual value operator > (const value) const;
-
-        virtual value operator && (const value) const;
-        virtual value operator || (const value) const;
-        virtual value arrow (const value) const;
-
-        virtual value operator & (const value) const;
-        virtual value operator | (const value) const;
-        virtual value implies (const value) const;
-
-    };
-
-    value evaluate (value v, const std::map<data::string, value> &vars);
-
-    std::ostream inline &operator << (std::ostream &o, value v) {
-        return v->write (o);
-    }
-
     struct evaluation {
         stack<value> Stack;
-        std::map<data::string, value> &Vars;
+        scope &Vars;
+        rewriter &Rules;
+
+        // symbols defined by the statement and their definitions, in order.
+        std::vector<std::pair<data::string, ref<const expression>>> Defined;
 
-        evaluation (std::map<data::string, value> &v) : Stack {}, Vars {v} {}
+        // rules added by the statement, as they were added.
+        std::vector<std::pair<ref<const expression>, ref<const expression>>> Added;
+
+        evaluation (scope &v, rewriter &r) : Stack {}, Vars {v}, Rules {r}, Defined {}, Added {} {}
 
         void read_symbol (const data::string &in);
         void read_string (const data::string &in);
         void read_number (const data::string &in);
+        void read_bytes (const data::string &in);
 
         void open_list ();
         void open_object ();
@@ -121,6 +55,7 @@ namespace Diophant {
         void comma ();
 
         void apply ();
+        void part ();
 
         void negate ();
         void mul ();
@@ -147,6 +82,7 @@ namespace Diophant {
         void intuitionistic_implies ();
 
         void set ();
+        void declare ();
     };
 }
 
@@ -156,6 +92,35 @@ namespace Diophant {
 
     template <typename Rule> struct eval_action : pegtl::nothing<Rule> {};
 
+    // Records a trace event around every action when tracing is on.
+    //
+    // Actions run as soon as their rules match, so a rule that fails after
+    // some of its parts have matched would leave their values on the stack.
+    // PEGTL tells a rule to rewind the input if it fails whenever anything
+    // else may be tried in its place, and in that case we rewind the stack
+    // as well. Since the stack is persistent, saving it is only a copy of a
+    // pointer, and whatever was built by the failed rule is dropped. Where
+    // PEGTL does not need to rewind, a failure fails the enclosing rule that
+    // does, which rewinds the stack for both.
+    template <typename Rule> struct eval_control : pegtl::normal<Rule> {
+        template <template <typename...> class Action, typename Iterator, typename Input, typename... States>
+        static auto apply (const Iterator &begin, const Input &in, States &&...st) {
+            trace::scope traced {pegtl::demangle<Rule> ()};
+            return pegtl::normal<Rule>::template apply<Action> (begin, in, st...);
+        }
+
+        template <pegtl::apply_mode A, pegtl::rewind_mode M,
+            template <typename...> class Action, template <typename...> class Control, typename Input>
+        static bool match (Input &in, Diophant::evaluation &eval) {
+            if constexpr (A == pegtl::apply_mode::action && M == pegtl::rewind_mode::required) {
+                stack<value> saved = eval.Stack;
+                if (pegtl::normal<Rule>::template match<A, M, Action, Control> (in, eval)) return true;
+                eval.Stack = saved;
+                return false;
+            } else return pegtl::normal<Rule>::template match<A, M, Action, Control> (in, eval);
+        }
+    };
+
     template <> struct eval_action<parse::number_lit> {
         template <typename Input>
         static void apply (const Input& in, Diophant::evaluation &eval) {
@@ -163,6 +128,13 @@ namespace Diophant {
         }
     };
 
+    template <> struct eval_action<parse::hex_lit> {
+        template <typename Input>
+        static void apply (const Input& in, Diophant::evaluation &eval) {
+            eval.read_bytes (in.string ());
+        }
+    };
+
     template <> struct eval_action<parse::string_body> {
         template <typename Input>
         static void apply (const Input& in, Diophant::evaluation &eval) {
@@ -177,6 +149,48 @@ namespace Diophant {
         }
     };
 
+    template <> struct eval_action<parse::open_list> {
+        template <typename Input>
+        static void apply (const Input& in, Diophant::evaluation &eval) {
+            eval.open_list ();
+        }
+    };
+
+    template <> struct eval_action<parse::close_list> {
+        template <typename Input>
+        static void apply (const Input& in, Diophant::evaluation &eval) {
+            eval.close_list ();
+        }
+    };
+
+    template <> struct eval_action<parse::open_object> {
+        template <typename Input>
+        static void apply (const Input& in, Diophant::evaluation &eval) {
+            eval.open_object ();
+        }
+    };
+
+    template <> struct eval_action<parse::close_object> {
+        template <typename Input>
+        static void apply (const Input& in, Diophant::evaluation &eval) {
+            eval.close_object ();
+        }
+    };
+
+    template <> struct eval_action<parse::call> {
+        template <typename Input>
+        static void apply (const Input& in, Diophant::evaluation &eval) {
+            eval.apply ();
+        }
+    };
+
+    template <> struct eval_action<parse::part> {
+        template <typename Input>
+        static void apply (const Input& in, Diophant::evaluation &eval) {
+            eval.part ();
+        }
+    };
+
     template <> struct eval_action<parse::negate_op> {
         template <typename Input>
         static void apply (const Input& in, Diophant::evaluation &eval) {
@@ -322,16 +336,13 @@ namespace Diophant {
         }
     };
 
-    template <> struct eval_action<parse::statement> {
+    template <> struct eval_action<parse::declare> {
         template <typename Input>
         static void apply (const Input& in, Diophant::evaluation &eval) {
-            if (data::size (eval.Stack) == 1) {
-                auto v = evaluate (eval.Stack.first (), eval.Vars);
-                v->write (std::cout << "\n result: ") << std::endl;
-                eval.Stack = data::stack<Diophant::value> {};
-            }
+            eval.declare ();
         }
     };
+
 }
 
 namespace Diophant {
@@ -340,18 +351,77 @@ namespace Diophant {
         Stack <<= expression::symbol (in);
     }
 
+    // literals are interned, so a literal that is read many times is stored once.
     void inline evaluation::read_string (const data::string &in) {
-        Stack <<= expression::string (in);
+        Stack <<= expression::string (rope {intern (in)});
     }
 
     void inline evaluation::read_number (const data::string &in) {
         Stack <<= expression::rational (Q {Z {in}});
     }
 
+    // 0x followed by any number of hex digits, which must come in pairs.
+    void inline evaluation::read_bytes (const data::string &in) {
+        auto digit = [] (char c) -> byte {
+            return byte (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+        };
+
+        if (in.size () % 2 != 0) {
+            Stack <<= expression::error ("a hex literal must have an even number of digits");
+            return;
+        }
+
+        data::bytes b ((in.size () - 2) / 2);
+        for (size_t i = 0; i < b.size (); i++) b[i] = byte (digit (in[2 + 2 * i]) << 4 | digit (in[3 + 2 * i]));
+        Stack <<= expression::bytes (b);
+    }
+
     void inline evaluation::apply () {
         Stack = prepend (rest (rest (Stack)), expression::apply (first (rest (Stack)), first (Stack)));
     }
 
+    // nothing read from the input is ever null, so we use null to mark
+    // where a list or object begins on the stack.
+    void inline evaluation::open_list () {
+        Stack <<= expression::null ();
+    }
+
+    void inline evaluation::open_object () {
+        Stack <<= expression::null ();
+    }
+
+    void evaluation::close_list () {
+        std::vector<ref<const expression>> elements;
+        while (first (Stack) != nullptr) {
+            elements.push_back (first (Stack));
+            Stack = rest (Stack);
+        }
+
+        std::reverse (elements.begin (), elements.end ());
+        Stack = prepend (rest (Stack), expression::list (std::move (elements)));
+    }
+
+    void evaluation::close_object () {
+        std::vector<ref<const expression>> elements;
+        while (first (Stack) != nullptr) {
+            elements.push_back (first (Stack));
+            Stack = rest (Stack);
+        }
+
+        std::vector<data::string> keys;
+        std::vector<ref<const expression>> values;
+        for (auto v = elements.rbegin (); v != elements.rend (); v += 2) {
+            keys.push_back ((*v)->write ());
+            values.push_back (*(v + 1));
+        }
+
+        Stack = prepend (rest (Stack), expression::object (keys, std::move (values)));
+    }
+
+    void inline evaluation::part () {
+        Stack = prepend (rest (rest (Stack)), expression::part (first (rest (Stack)), first (Stack)));
+    }
+
     void inline evaluation::negate () {
         Stack = prepend (rest (Stack), expression::negate (first (Stack)));
     }
@@ -428,16 +498,39 @@ namespace Diophant {
         Stack = prepend (rest (rest (Stack)), expression::intuitionistic_implies (first (rest (Stack)), first (Stack)));
     }
 
-    value inline evaluate (const value v, const std::map<data::string, value> &vars) {
+    value evaluate (const value v, const scope &vars) {
         if (v == nullptr) return v;
 
+        meter::step ();
+        if constexpr (stats::enabled) stats::evaluated (v->kind ());
+        if (trace::active ()) {
+            trace::scope traced {stats::name (v->kind ())};
+            return v->evaluate (vars);
+        }
+
         return v->evaluate (vars);
     }
 
+    // Arithmetic on unknowns produces polynomials where it can. Returns
+    // nullptr if the operation cannot be done on polynomials.
+    ref<const expression> polynomial_operation (stats::node op, value a, value b);
+
     struct boolean : expression {
         bool Value;
         boolean (const bool b) : Value {b} {}
 
+        stats::node kind () const override {
+            return stats::node::boolean;
+        }
+
+        bool identical (const expression &e) const override {
+            return Value == static_cast<const boolean &> (e).Value;
+        }
+
+        uint64 compute_hash () const override {
+            return combine (uint64 (kind ()), Value);
+        }
+
         std::ostream &write (std::ostream &o) const override {
             return o << std::boolalpha << Value;
         }
@@ -447,40 +540,161 @@ namespace Diophant {
         }
 
         value operator && (value v) const override {
-            auto r = std::dynamic_pointer_cast<const boolean> (v);
-            if (r == nullptr) return this->shared_from_this ();
+            auto r = dynamic_ref_cast<const boolean> (v);
+            if (r == nullptr) return expression::operator && (v);
             return expression::boolean (Value && r->Value);
         }
 
         value operator || (value v) const override {
-            auto r = std::dynamic_pointer_cast<const boolean> (v);
-            if (r == nullptr) return this->shared_from_this ();
+            auto r = dynamic_ref_cast<const boolean> (v);
+            if (r == nullptr) return expression::operator || (v);
             return expression::boolean (Value || r->Value);
         }
     };
 
+    // Names are interned, so symbols with the same name share their text.
     struct symbol : expression {
-        data::string Name;
-        symbol (const data::string &x) : Name {x} {}
+        ptr<const data::string> Name;
+        symbol (ptr<const data::string> x) : Name {x} {}
 
-        std::ostream &write (std::ostream &o) const override {
-            return o << Name;
+        stats::node kind () const override {
+            return stats::node::symbol;
+        }
+
+        bool identical (const expression &e) const override {
+            return Name == static_cast<const symbol &> (e).Name;
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto x = vars.find (Name);
-            if (x == vars.end ()) throw exception {} << "undefined symbol " << Name;
+        uint64 compute_hash () const override {
+            return combine (uint64 (kind ()), hash_bytes (*Name));
+        }
+
+        std::ostream &write (std::ostream &o) const override {
+            return o << *Name;
+        }
 
-            return Diophant::evaluate (x->second, vars);
+        value evaluate (const scope &vars) const override {
+            return vars.evaluate (*Name);
         };
     };
 
     struct string : expression {
-        data::string Value;
-        string (const data::string &x) : Value {x} {}
+        rope Value;
+        string (const rope &x) : Value {x} {}
+
+        stats::node kind () const override {
+            return stats::node::string;
+        }
+
+        bool identical (const expression &e) const override {
+            return Value == static_cast<const string &> (e).Value;
+        }
+
+        uint64 compute_hash () const override {
+            return combine (uint64 (kind ()), Value.hash ());
+        }
+
+        std::ostream &write (std::ostream &o) const override {
+            return Value.write (o << "\"") << "\"";
+        }
+
+        value operator + (const value v) const override {
+            auto r = dynamic_ref_cast<const string> (v);
+            if (r == nullptr) return expression::operator + (v);
+            return expression::string (Value + r->Value);
+        }
+    };
+
+    // A string of bytes, such as a script, a key or a digest, which is read
+    // from a hex literal and written the same way.
+    struct bytes : expression {
+        data::bytes Value;
+        bytes (const data::bytes &x) : Value {x} {}
+
+        std::string_view view () const {
+            return std::string_view {reinterpret_cast<const char *> (Value.data ()), Value.size ()};
+        }
+
+        stats::node kind () const override {
+            return stats::node::bytes;
+        }
+
+        bool identical (const expression &e) const override {
+            return view () == static_cast<const bytes &> (e).view ();
+        }
+
+        uint64 compute_hash () const override {
+            return combine (uint64 (kind ()), hash_bytes (view ()));
+        }
+
+        std::ostream &write (std::ostream &o) const override {
+            static const char *Digits = "0123456789abcdef";
+            o << "0x";
+            for (byte b : Value) o << Digits[b >> 4] << Digits[b & 15];
+            return o;
+        }
+
+        value operator + (const value v) const override {
+            auto r = dynamic_ref_cast<const bytes> (v);
+            if (r == nullptr) return expression::operator + (v);
+            data::bytes x (Value.size () + r->Value.size ());
+            std::copy (Value.begin (), Value.end (), x.begin ());
+            std::copy (r->Value.begin (), r->Value.end (), x.begin () + Value.size ());
+            return expression::bytes (x);
+        }
+    };
+
+    struct error : expression {
+        ptr<const data::string> Message;
+        error (ptr<const data::string> m) : Message {m} {}
+
+        stats::node kind () const override {
+            return stats::node::error;
+        }
+
+        bool identical (const expression &e) const override {
+            return *Message == *static_cast<const error &> (e).Message;
+        }
+
+        uint64 compute_hash () const override {
+            return combine (uint64 (kind ()), hash_bytes (*Message));
+        }
+
+        std::ostream &write (std::ostream &o) const override {
+            return o << "error (\"" << *Message << "\")";
+        }
+    };
+
+    struct builtin : expression {
+        data::string Name;
+        std::function<value (value)> Function;
+        std::function<void (value)> Prepare;
+        builtin (const data::string &name, std::function<value (value)> f, std::function<void (value)> p) :
+            Name {name}, Function {f}, Prepare {p} {}
+
+        stats::node kind () const override {
+            return stats::node::builtin;
+        }
+
+        // there is only one builtin of any name.
+        bool identical (const expression &e) const override {
+            return Name == static_cast<const builtin &> (e).Name;
+        }
+
+        uint64 compute_hash () const override {
+            return combine (uint64 (kind ()), hash_bytes (Name));
+        }
 
         std::ostream &write (std::ostream &o) const override {
-            return o << "\"" << Value << "\"";
+            return o << Name;
+        }
+
+        void prepare (const value v) const override {
+            if (Prepare) Prepare (v);
+        }
+
+        value operator () (const value v) const override {
+            return Function (v);
         }
     };
 
@@ -488,914 +702,1964 @@ namespace Diophant {
         data::Q Value;
         rational (const data::Q &q) : Value {q} {}
 
+        stats::node kind () const override {
+            return stats::node::rational;
+        }
+
+        // rationals are always stored in lowest terms, so identical means equal.
+        bool identical (const expression &e) const override {
+            return Value == static_cast<const rational &> (e).Value;
+        }
+
+        uint64 compute_hash () const override {
+            return hash_number (Value, uint64 (kind ()));
+        }
+
         std::ostream &write (std::ostream &o) const override {
             o << Value.Numerator;
             if (Value.Denominator != 1) o << "/" << Value.Denominator;
             return o;
         }
 
+        // a fraction is written as a division and a negative number as a negation.
+        uint32 precedence () const override {
+            if (Value.Denominator != 1) return 500;
+            return Value < Q {Z {0}} ? 200 : 0;
+        }
+
         value operator - () const override {
             return expression::rational (-Value);
         }
 
         value operator + (value v) const override {
-            auto r = std::dynamic_pointer_cast<const rational> (v);
-            if (r == nullptr) return this->shared_from_this ();
+            auto r = dynamic_ref_cast<const rational> (v);
+            if (r == nullptr) return expression::operator + (v);
             return expression::rational (Value + r->Value);
         }
 
         value operator - (value v) const override {
-            auto r = std::dynamic_pointer_cast<const rational> (v);
-            if (r == nullptr) return this->shared_from_this ();
+            auto r = dynamic_ref_cast<const rational> (v);
+            if (r == nullptr) return expression::operator - (v);
             return expression::rational (Value - r->Value);
         }
 
         value operator * (value v) const override {
-            auto r = std::dynamic_pointer_cast<const rational> (v);
-            if (r == nullptr) return this->shared_from_this ();
+            auto r = dynamic_ref_cast<const rational> (v);
+            if (r == nullptr) return expression::operator * (v);
             return expression::rational (Value * r->Value);
         }
 
         value operator / (value v) const override {
-            auto r = std::dynamic_pointer_cast<const rational> (v);
-            if (r == nullptr) return this->shared_from_this ();
+            auto r = dynamic_ref_cast<const rational> (v);
+            if (r == nullptr) return expression::operator / (v);
+            if (r->Value.Numerator == 0) return expression::error ("division by zero");
             return expression::rational (Value / math::nonzero<Q> (r->Value));
         }
     };
 
-    struct list : expression {
-        data::list<value> Value;
-        list (data::list<value> v) : Value {v} {}
-
-        std::ostream &write (std::ostream &o) const override {
-            o << "[";
+    // A number modulo the prime or the order of secp256k1, which is made
+    // from a rational by modp or modn. It is written the same way.
+    struct modular : expression {
+        const montgomery *Field;
+        // in Montgomery form.
+        uint256 Value;
+        modular (const montgomery &f, const uint256 &x) : Field {&f}, Value {x} {}
 
-            if (!data::empty (Value)) {
-                first (Value)->write (o);
-                for (const auto v : rest (Value)) v->write (o << ", ");
-            }
+        stats::node kind () const override {
+            return stats::node::modular;
+        }
 
-            return o << "]";
+        bool identical (const expression &e) const override {
+            const auto &m = static_cast<const modular &> (e);
+            return Field == m.Field && Value == m.Value;
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            data::list<value> vvvvvv;
-            for (value &v : Value) vvvvvv <<= Diophant::evaluate (v, vars);
-            return expression::list (vvvvvv);
-        };
-    };
+        uint64 compute_hash () const override {
+            uint64 h = combine (uint64 (kind ()), hash_bytes (Field->Name));
+            for (uint64 x : Value) h = combine (h, x);
+            return h;
+        }
 
-    struct object : expression {
-        data::list<entry<data::string, value>> Value;
-        object (data::list<entry<data::string, value>> v) : Value {v} {}
+        uint32 precedence () const override {
+            return 100;
+        }
 
         std::ostream &write (std::ostream &o) const override {
-            o << "{";
+            return o << Field->Name << " " << Field->write (Value);
+        }
+    };
 
-            if (!data::empty (Value)) {
-                auto e = first (Value);
-                e.Value->write (o << e.Key << ": ");
-                for (const auto e : rest (Value)) e.Value->write (o << ", " << e.Key << ": ");
-            }
+    value inline make_modular (const montgomery &f, const uint256 &x) {
+        stats::number ();
+        return make_ref<modular> (f, x);
+    }
 
-            return o << "}";
+    // A rational as a number mod m, which is possible unless its denominator
+    // is a multiple of m. Returns an error if it is not a rational.
+    value lift (const montgomery &f, value v) {
+        if (auto m = dynamic_ref_cast<const modular> (v); m != nullptr) {
+            if (m->Field == &f) return v;
+            return expression::error ("cannot use " + v->write () + " as a number in " + f.Name);
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            return expression::object (data::for_each ([&vars] (entry<data::string, value> v) -> entry<data::string, value> {
-                return entry<data::string, value> {v.Key, Diophant::evaluate (v.Value, vars)};
-            }, Value));
+        auto r = dynamic_ref_cast<const rational> (v);
+        if (r == nullptr) return expression::error ("cannot use " + (v == nullptr ? data::string {"null"} : v->write ()) + " as a number in " + f.Name);
+
+        auto digits = [] (const Z &z) -> std::string {
+            std::stringstream ss;
+            ss << (z < 0 ? -z : z);
+            return ss.str ();
         };
-    };
 
-    struct apply : expression {
-        value Left;
-        value Right;
-        apply (const value &a, const value &b) : Left {a}, Right {b} {}
+        uint256 n = f.read (digits (r->Value.Numerator));
+        if (r->Value.Numerator < 0) n = f.negate (n);
+        if (r->Value.Denominator == 1) return make_modular (f, n);
+
+        uint256 d = f.read (digits (r->Value.Denominator));
+        if (is_zero (d)) return expression::error ("cannot use " + v->write () + " as a number in " + f.Name + " because its denominator is not invertible");
+        return make_modular (f, f.multiply (n, f.invert (d)));
+    }
+
+    // an exponent that fits in 256 bits.
+    maybe<uint256> read_modular_exponent (const Z &z) {
+        std::stringstream ss;
+        ss << z;
+        uint256 x {0, 0, 0, 0};
+        for (char d : ss.str ()) {
+            unsigned __int128 c = uint64 (d - '0');
+            for (uint64 &limb : x) {
+                c += (unsigned __int128) limb * 10;
+                limb = uint64 (c);
+                c >>= 64;
+            }
 
-        uint32 precedence () const override {
-            return 100;
+            if (c != 0) return {};
         }
 
-        std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+        return x;
+    }
+
+    // Arithmetic in which either side is modular. The other side may be a
+    // number with the same modulus or a rational. Returns nullptr if neither
+    // side is modular or the other side could be anything, so that the
+    // operation is left as it is.
+    ref<const expression> modular_operation (stats::node op, value a, value b) {
+        auto x = dynamic_ref_cast<const modular> (a);
+        auto y = dynamic_ref_cast<const modular> (b);
+        if (x == nullptr && y == nullptr) return nullptr;
+
+        const montgomery &f = x != nullptr ? *x->Field : *y->Field;
+        if (op == stats::node::negate) return make_modular (f, f.negate (x->Value));
+
+        if (op == stats::node::power) {
+            auto r = dynamic_ref_cast<const rational> (b);
+            if (x == nullptr || r == nullptr) return nullptr;
+            if (r->Value.Denominator != 1) return expression::error ("exponent " + b->write () + " is not an integer");
+
+            bool negative = r->Value.Numerator < 0;
+            auto n = read_modular_exponent (negative ? -r->Value.Numerator : r->Value.Numerator);
+            if (!n) return expression::error ("exponent " + b->write () + " is too big");
+            if (negative && is_zero (x->Value)) return expression::error ("division by zero");
+            return make_modular (f, f.pow (negative ? f.invert (x->Value) : x->Value, *n));
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return (*a) (b);
-        };
-    };
+        for (const auto &v : {a, b}) if (v == nullptr || (v->kind () != stats::node::modular && v->kind () != stats::node::rational)) return nullptr;
 
-    struct negate : expression {
-        value Value;
-        negate (const value &v) : Value {v} {}
+        auto u = lift (f, a);
+        if (is_error (u)) return u;
+        auto v = lift (f, b);
+        if (is_error (v)) return v;
 
-        uint32 precedence () const override {
-            return 200;
+        const uint256 &p = static_cast<const modular &> (*u).Value;
+        const uint256 &q = static_cast<const modular &> (*v).Value;
+        switch (op) {
+            case stats::node::plus: return make_modular (f, f.add (p, q));
+            case stats::node::minus: return make_modular (f, f.subtract (p, q));
+            case stats::node::times: return make_modular (f, f.multiply (p, q));
+            case stats::node::divide: {
+                if (is_zero (q)) return expression::error ("division by zero");
+                return make_modular (f, f.multiply (p, f.invert (q)));
+            }
+            default: return nullptr;
         }
+    }
 
-        std::ostream &write (std::ostream &o) const override {
-            o << "-";
-            if (Value->precedence () > precedence ()) return Value->write (o << "(") << ")";
-            else return Value->write (o);
+    // Read an index for a list from a part expression. Returns an error if
+    // the key is not an index, or nothing if it is.
+    ref<const expression> read_index (value key, size_t size, size_t &index) {
+        auto r = dynamic_ref_cast<const rational> (key);
+        if (r == nullptr || r->Value.Denominator != 1) return expression::error ("list index " + key->write () + " is not an integer");
+        if (r->Value.Numerator < 0 || r->Value.Numerator >= Z {int64 (size)})
+            return expression::error ("list index " + key->write () + " is out of range");
+        index = size_t (int64 (r->Value.Numerator));
+        return nullptr;
+    }
+
+    // the first error in a sequence of values, if there is one.
+    ref<const expression> first_error (const std::vector<ref<const expression>> &x) {
+        for (const auto &v : x) if (is_error (v)) return v;
+        return nullptr;
+    }
+
+    struct list : expression {
+        // stored contiguously so that positional access is constant time.
+        std::vector<ref<const expression>> Value;
+        list (data::list<value> v) {
+            for (const auto &x : v) Value.push_back (x);
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto v = Diophant::evaluate (Value, vars);
-            if (v.get () == nullptr) return expression::negate (v);
-            return -(*v);
-        };
-    };
+        list (std::vector<ref<const expression>> &&v) : Value {std::move (v)} {}
 
-    struct boolean_not : expression {
-        value Value;
-        boolean_not (const value &v) : Value {v} {}
+        stats::node kind () const override {
+            return stats::node::list;
+        }
 
-        uint32 precedence () const override {
-            return 200;
+        bool identical (const expression &e) const override {
+            const auto &x = static_cast<const list &> (e);
+            if (Value.size () != x.Value.size ()) return false;
+            for (size_t i = 0; i < Value.size (); i++) if (!Diophant::identical (Value[i], x.Value[i])) return false;
+            return true;
         }
 
-        std::ostream &write (std::ostream &o) const override {
-            o << "!";
-            if (Value->precedence () > precedence ()) return Value->write (o << "(") << ")";
-            else return Value->write (o);
+        uint64 compute_hash () const override {
+            uint64 h = uint64 (kind ());
+            for (const auto &v : Value) h = combine (h, structural_hash (v));
+            return h;
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto v = Diophant::evaluate (Value, vars);
-            if (v.get () == nullptr) return expression::negate (v);
-            return !(*v);
-        };
-    };
+        size_t arity () const override {
+            return Value.size ();
+        }
 
-    struct plus : expression {
-        value Left;
-        value Right;
-        plus (const value &a, const value &b) : Left {a}, Right {b} {}
+        value child (size_t i) const override {
+            return Value[i];
+        }
 
-        uint32 precedence () const override {
-            return 300;
+        value with (std::vector<ref<const expression>> &&x) const override {
+            return expression::list (std::move (x));
+        }
+
+        uint64 head () const override {
+            return combine (uint64 (kind ()), Value.size ());
         }
 
         std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " + ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+            o << "[";
+
+            if (!Value.empty ()) {
+                o << Value[0];
+                for (size_t i = 1; i < Value.size (); i++) o << ", " << Value[i];
+            }
+
+            return o << "]";
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return *a + b;
+        value evaluate (const scope &vars) const override {
+            std::vector<ref<const expression>> evaluated;
+            evaluated.reserve (Value.size ());
+            for (const auto &v : Value) evaluated.push_back (Diophant::evaluate (v, vars));
+            if (auto e = first_error (evaluated); e != nullptr) return e;
+            return expression::list (std::move (evaluated));
         };
+
+        value part (const value key) const override {
+            size_t i;
+            if (auto e = read_index (key, Value.size (), i); e != nullptr) return e;
+            return Value[i];
+        }
     };
 
-    struct minus : expression {
-        value Left;
-        value Right;
-        minus (const value &a, const value &b) : Left {a}, Right {b} {}
+    // Objects that have the same keys in the same order share a shape,
+    // which maps each key to the position of its value in the object.
+    // Field access is therefore a single hash lookup regardless of how
+    // many fields an object has, and evaluating an object never needs
+    // to look at its keys at all.
+    struct shape {
+        std::vector<data::string> Keys;
+        std::unordered_map<std::string, size_t> Index;
 
-        uint32 precedence () const override {
-            return 400;
+        shape (const std::vector<data::string> &keys) : Keys {keys} {
+            for (size_t i = 0; i < Keys.size (); i++)
+                if (!Index.emplace (Keys[i], i).second) throw exception {} << "duplicate key " << Keys[i] << " in object";
         }
 
-        std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " - ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+        maybe<size_t> find (const std::string &key) const {
+            auto x = Index.find (key);
+            if (x == Index.end ()) return {};
+            return x->second;
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return *a - b;
-        };
+        static ptr<const shape> make (const std::vector<data::string> &keys);
     };
 
-    struct times : expression {
-        value Left;
-        value Right;
-        times (const value &a, const value &b) : Left {a}, Right {b} {}
+    // A shape takes itself out of the table when the last object that has
+    // it is gone. The table is never destroyed, because objects held in
+    // other static variables can outlive it.
+    ptr<const shape> shape::make (const std::vector<data::string> &keys) {
+        using table = std::map<std::vector<data::string>, std::weak_ptr<const shape>>;
+        static std::mutex &Mutex = *new std::mutex {};
+        static table &Shapes = *new table {};
+
+        std::lock_guard<std::mutex> lock (Mutex);
+        auto known = Shapes.find (keys);
+        if (known != Shapes.end ())
+            if (auto s = known->second.lock (); s != nullptr) return s;
+
+        ptr<const shape> s {new shape {keys}, [] (const shape *x) {
+            {
+                std::lock_guard<std::mutex> lock (Mutex);
+                // a new shape with the same keys may have been made since this one expired.
+                auto known = Shapes.find (x->Keys);
+                if (known != Shapes.end () && known->second.expired ()) Shapes.erase (known);
+            }
 
-        uint32 precedence () const override {
-            return 500;
+            delete x;
+        }};
+
+        Shapes[keys] = s;
+        return s;
+    }
+
+    struct object : expression {
+        ptr<const shape> Shape;
+        std::vector<ref<const expression>> Value;
+
+        object (data::list<entry<data::string, value>> v) {
+            std::vector<data::string> keys;
+            for (const auto &e : v) {
+                keys.push_back (e.Key);
+                Value.push_back (e.Value);
+            }
+
+            Shape = shape::make (keys);
+        }
+
+        object (ptr<const shape> s, std::vector<ref<const expression>> &&v) : Shape {s}, Value {std::move (v)} {}
+
+        void freeze () const override {
+            if (frozen ()) return;
+            expression::freeze ();
+            for (const auto &v : Value) if (v != nullptr) v->freeze ();
+        }
+
+        stats::node kind () const override {
+            return stats::node::object;
+        }
+
+        // shapes are shared, so objects with the same keys have the same shape.
+        bool identical (const expression &e) const override {
+            const auto &x = static_cast<const object &> (e);
+            if (Shape != x.Shape) return false;
+            for (size_t i = 0; i < Value.size (); i++) if (!Diophant::identical (Value[i], x.Value[i])) return false;
+            return true;
+        }
+
+        uint64 compute_hash () const override {
+            uint64 h = uint64 (kind ());
+            for (size_t i = 0; i < Value.size (); i++)
+                h = combine (combine (h, hash_bytes (Shape->Keys[i])), structural_hash (Value[i]));
+            return h;
+        }
+
+        size_t arity () const override {
+            return Value.size ();
+        }
+
+        value child (size_t i) const override {
+            return Value[i];
+        }
+
+        value with (std::vector<ref<const expression>> &&x) const override {
+            return make_ref<object> (Shape, std::move (x));
+        }
+
+        // objects with different keys have different heads.
+        uint64 head () const override {
+            uint64 h = uint64 (kind ());
+            for (const auto &k : Shape->Keys) h = combine (h, hash_bytes (k));
+            return h;
         }
 
         std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " * ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+            o << "{";
+
+            if (!Value.empty ()) {
+                o << Shape->Keys[0] << ": " << Value[0];
+                for (size_t i = 1; i < Value.size (); i++) o << ", " << Shape->Keys[i] << ": " << Value[i];
+            }
+
+            return o << "}";
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return *a * b;
+        value evaluate (const scope &vars) const override {
+            std::vector<ref<const expression>> evaluated;
+            evaluated.reserve (Value.size ());
+            for (const auto &v : Value) evaluated.push_back (Diophant::evaluate (v, vars));
+            if (auto e = first_error (evaluated); e != nullptr) return e;
+            return make_ref<object> (Shape, std::move (evaluated));
         };
+
+        value part (const value key) const override {
+            // fields can be accessed by name or by position.
+            if (auto x = dynamic_ref_cast<const Diophant::symbol> (key); x != nullptr) {
+                auto i = Shape->find (*x->Name);
+                if (!i) return expression::error ("object has no field " + *x->Name);
+                return Value[*i];
+            }
+
+            size_t i;
+            if (auto e = read_index (key, Value.size (), i); e != nullptr) return e;
+            return Value[i];
+        }
     };
 
-    struct power : expression {
-        value Left;
-        value Right;
-        power (const value &a, const value &b) : Left {a}, Right {b} {}
+    struct part : expression {
+        value Value;
+        value Key;
+        part (const value &v, const value &k) : Value {v}, Key {k} {}
 
-        uint32 precedence () const override {
-            return 550;
+        void freeze () const override {
+            if (frozen ()) return;
+            expression::freeze ();
+            if (Key != nullptr) Key->freeze ();
+        }
+
+        stats::node kind () const override {
+            return stats::node::part;
+        }
+
+        bool identical (const expression &e) const override {
+            const auto &x = static_cast<const part &> (e);
+            return Diophant::identical (Value, x.Value) && Diophant::identical (Key, x.Key);
+        }
+
+        uint64 compute_hash () const override {
+            return combine (combine (uint64 (kind ()), structural_hash (Value)), structural_hash (Key));
+        }
+
+        // the key is a name or an index rather than a subexpression.
+        size_t arity () const override {
+            return 1;
+        }
+
+        value child (size_t) const override {
+            return Value;
+        }
+
+        value with (std::vector<ref<const expression>> &&x) const override {
+            return expression::part (x[0], Key);
+        }
+
+        uint64 head () const override {
+            return combine (uint64 (kind ()), structural_hash (Key));
         }
 
         std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " ^ ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+            if (Value->precedence () > precedence ()) Value->write (o << "(") << ")";
+            else Value->write (o);
+            return Key->write (o << "@");
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return *a ^ b;
+        // the key is not evaluated because a symbol here is a field name.
+        value evaluate (const scope &vars) const override {
+            auto v = Diophant::evaluate (Value, vars);
+            if (v.get () == nullptr) return expression::error ("cannot take part " + Key->write () + " of null");
+            if (is_error (v)) return v;
+            return v->part (Key);
         };
     };
 
-    struct divide : expression {
-        value Left;
-        value Right;
-        divide (const value &a, const value &b) : Left {a}, Right {b} {}
+    struct unary_operation : expression {
+        value Value;
+        unary_operation (const value &v) : Value {v} {}
 
-        uint32 precedence () const override {
-            return 600;
+        size_t arity () const override {
+            return 1;
         }
 
-        std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " / ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+        value child (size_t) const override {
+            return Value;
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return *a / b;
-        };
+        value with (std::vector<ref<const expression>> &&x) const override {
+            switch (kind ()) {
+                case stats::node::negate: return expression::negate (x[0]);
+                case stats::node::boolean_not: return expression::boolean_not (x[0]);
+                default: throw exception {} << "unknown unary operation";
+            }
+        }
+
+        bool identical (const expression &e) const override {
+            return Diophant::identical (Value, static_cast<const unary_operation &> (e).Value);
+        }
+
+        uint64 compute_hash () const override {
+            return combine (uint64 (kind ()), structural_hash (Value));
+        }
     };
 
-    struct equal : expression {
+    struct binary_operation : expression {
         value Left;
         value Right;
-        equal (const value &a, const value &b) : Left {a}, Right {b} {}
+        binary_operation (const value &a, const value &b) : Left {a}, Right {b} {}
+
+        size_t arity () const override {
+            return 2;
+        }
+
+        value child (size_t i) const override {
+            return i == 0 ? Left : Right;
+        }
+
+        value with (std::vector<ref<const expression>> &&x) const override {
+            switch (kind ()) {
+                case stats::node::apply: return expression::apply (x[0], x[1]);
+                case stats::node::plus: return expression::plus (x[0], x[1]);
+                case stats::node::minus: return expression::minus (x[0], x[1]);
+                case stats::node::times: return expression::times (x[0], x[1]);
+                case stats::node::power: return expression::power (x[0], x[1]);
+                case stats::node::divide: return expression::divide (x[0], x[1]);
+                case stats::node::equal: return expression::equal (x[0], x[1]);
+                case stats::node::unequal: return expression::unequal (x[0], x[1]);
+                case stats::node::greater_equal: return expression::greater_equal (x[0], x[1]);
+                case stats::node::less_equal: return expression::less_equal (x[0], x[1]);
+                case stats::node::greater: return expression::greater (x[0], x[1]);
+                case stats::node::less: return expression::less (x[0], x[1]);
+                case stats::node::boolean_and: return expression::boolean_and (x[0], x[1]);
+                case stats::node::boolean_or: return expression::boolean_or (x[0], x[1]);
+                case stats::node::arrow: return expression::arrow (x[0], x[1]);
+                case stats::node::intuitionistic_and: return expression::intuitionistic_and (x[0], x[1]);
+                case stats::node::intuitionistic_or: return expression::intuitionistic_or (x[0], x[1]);
+                case stats::node::intuitionistic_implies: return expression::intuitionistic_implies (x[0], x[1]);
+                default: throw exception {} << "unknown binary operation";
+            }
+        }
+
+        bool identical (const expression &e) const override {
+            const auto &b = static_cast<const binary_operation &> (e);
+            return Diophant::identical (Left, b.Left) && Diophant::identical (Right, b.Right);
+        }
+
+        uint64 compute_hash () const override {
+            return combine (combine (uint64 (kind ()), structural_hash (Left)), structural_hash (Right));
+        }
+    };
+
+    struct apply : binary_operation {
+        apply (const value &a, const value &b) : binary_operation {a, b} {}
+
+        stats::node kind () const override {
+            return stats::node::apply;
+        }
 
         uint32 precedence () const override {
-            return 700;
+            return 100;
         }
 
+        // application is the one thing in the grammar that associates to the left.
         std::ostream &write (std::ostream &o) const override {
             if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
             else Left->write (o);
-            o << " == ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
+            o << " ";
+            if (Right->precedence () >= precedence ()) return Right->write (o << "(") << ")";
             else return Right->write (o);
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
+        value evaluate (const scope &vars) const override {
             auto a = Diophant::evaluate (Left, vars);
+            if (is_error (a)) return a;
             auto b = Diophant::evaluate (Right, vars);
+            if (is_error (b)) return b;
             if (a.get () == nullptr) return expression::apply (a, b);
-            return *a == b;
+            return (*a) (b);
         };
     };
 
-    struct unequal : expression {
-        value Left;
-        value Right;
-        unequal (const value &a, const value &b) : Left {a}, Right {b} {}
+    struct negate : unary_operation {
+        negate (const value &v) : unary_operation {v} {}
+
+        stats::node kind () const override {
+            return stats::node::negate;
+        }
 
         uint32 precedence () const override {
-            return 700;
+            return 200;
         }
 
         std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " != ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+            o << "-";
+            if (Value->precedence () > precedence ()) return Value->write (o << "(") << ")";
+            else return Value->write (o);
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return *a != b;
+        value evaluate (const scope &vars) const override {
+            auto v = Diophant::evaluate (Value, vars);
+            if (v.get () == nullptr) return expression::negate (v);
+            if (is_error (v)) return v;
+            return -(*v);
         };
     };
 
-    struct greater_equal : expression {
-        value Left;
-        value Right;
-        greater_equal (const value &a, const value &b) : Left {a}, Right {b} {}
+    struct boolean_not : unary_operation {
+        boolean_not (const value &v) : unary_operation {v} {}
+
+        stats::node kind () const override {
+            return stats::node::boolean_not;
+        }
 
         uint32 precedence () const override {
-            return 700;
+            return 200;
         }
 
         std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " >= ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+            o << "!";
+            if (Value->precedence () > precedence ()) return Value->write (o << "(") << ")";
+            else return Value->write (o);
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return *a >= b;
+        value evaluate (const scope &vars) const override {
+            auto v = Diophant::evaluate (Value, vars);
+            if (v.get () == nullptr) return expression::negate (v);
+            if (is_error (v)) return v;
+            return !(*v);
         };
     };
 
-    struct less_equal : expression {
-        value Left;
-        value Right;
-        less_equal (const value &a, const value &b) : Left {a}, Right {b} {}
+    // The parts of a binary operator that differ from one operator to the
+    // next. The node for each operator is generated from its traits by
+    // binary_op below, so the kernel is known at compile time and can be
+    // inlined into evaluate. Kernels are called with a left side that is
+    // not null unless the traits say that they are not strict. They handle
+    // the most common types of operands directly before falling back on the
+    // virtual operators.
+    template <stats::node> struct operator_traits;
+
+    // defaults for the traits.
+    struct operator_defaults {
+        // evaluated together with neighbors of the same family; see chain below.
+        static constexpr bool Chain = false;
+        // a null left side makes the operator an application.
+        static constexpr bool Strict = true;
+    };
 
-        uint32 precedence () const override {
-            return 700;
+    bool inline rationals (value a, value b) {
+        return a->kind () == stats::node::rational && b != nullptr && b->kind () == stats::node::rational;
+    }
+
+    bool inline booleans (value a, value b) {
+        return a->kind () == stats::node::boolean && b != nullptr && b->kind () == stats::node::boolean;
+    }
+
+    const Q inline &number (value v) {
+        return static_cast<const rational &> (*v).Value;
+    }
+
+    bool inline truth (value v) {
+        return static_cast<const boolean &> (*v).Value;
+    }
+
+    template <> struct operator_traits<stats::node::plus> : operator_defaults {
+        static constexpr const char *Symbol = " + ";
+        static constexpr uint32 Precedence = 650;
+        static constexpr bool Chain = true;
+
+        static value kernel (value a, value b) {
+            if (rationals (a, b)) return expression::rational (number (a) + number (b));
+            return *a + b;
         }
+    };
 
-        std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " <= ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+    template <> struct operator_traits<stats::node::minus> : operator_defaults {
+        static constexpr const char *Symbol = " - ";
+        static constexpr uint32 Precedence = 600;
+        static constexpr bool Chain = true;
+
+        static value kernel (value a, value b) {
+            if (rationals (a, b)) return expression::rational (number (a) - number (b));
+            return *a - b;
         }
+    };
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return *a <= b;
-        };
+    template <> struct operator_traits<stats::node::times> : operator_defaults {
+        static constexpr const char *Symbol = " * ";
+        static constexpr uint32 Precedence = 300;
+        static constexpr bool Chain = true;
+
+        static value kernel (value a, value b) {
+            if (rationals (a, b)) return expression::rational (number (a) * number (b));
+            return *a * b;
+        }
     };
 
-    struct greater : expression {
-        value Left;
-        value Right;
-        greater (const value &a, const value &b) : Left {a}, Right {b} {}
+    template <> struct operator_traits<stats::node::power> : operator_defaults {
+        static constexpr const char *Symbol = " ^ ";
+        static constexpr uint32 Precedence = 400;
 
-        uint32 precedence () const override {
-            return 700;
+        static value kernel (value a, value b) {
+            return *a ^ b;
         }
+    };
 
-        std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " > ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+    template <> struct operator_traits<stats::node::divide> : operator_defaults {
+        static constexpr const char *Symbol = " / ";
+        static constexpr uint32 Precedence = 500;
+
+        static value kernel (value a, value b) {
+            if (rationals (a, b)) {
+                if (number (b).Numerator == 0) return expression::error ("division by zero");
+                return expression::rational (number (a) / math::nonzero<Q> {number (b)});
+            }
+
+            return *a / b;
         }
+    };
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return *a > b;
-        };
+    template <> struct operator_traits<stats::node::equal> : operator_defaults {
+        static constexpr const char *Symbol = " == ";
+        static constexpr uint32 Precedence = 700;
+        static constexpr bool Strict = false;
+
+        static value kernel (value a, value b) {
+            return expression::boolean (Diophant::identical (a, b));
+        }
     };
 
-    struct less : expression {
-        value Left;
-        value Right;
-        less (const value &a, const value &b) : Left {a}, Right {b} {}
+    template <> struct operator_traits<stats::node::unequal> : operator_defaults {
+        static constexpr const char *Symbol = " != ";
+        static constexpr uint32 Precedence = 700;
+        static constexpr bool Strict = false;
 
-        uint32 precedence () const override {
-            return 700;
+        static value kernel (value a, value b) {
+            return expression::boolean (!Diophant::identical (a, b));
         }
+    };
 
-        std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " < ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+    template <> struct operator_traits<stats::node::greater_equal> : operator_defaults {
+        static constexpr const char *Symbol = " >= ";
+        static constexpr uint32 Precedence = 700;
+
+        static value kernel (value a, value b) {
+            return *a >= b;
         }
+    };
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return *a < b;
-        };
+    template <> struct operator_traits<stats::node::less_equal> : operator_defaults {
+        static constexpr const char *Symbol = " <= ";
+        static constexpr uint32 Precedence = 700;
+
+        static value kernel (value a, value b) {
+            return *a <= b;
+        }
     };
 
-    struct boolean_and : expression {
-        value Left;
-        value Right;
-        boolean_and (const value &a, const value &b) : Left {a}, Right {b} {}
+    template <> struct operator_traits<stats::node::greater> : operator_defaults {
+        static constexpr const char *Symbol = " > ";
+        static constexpr uint32 Precedence = 700;
 
-        uint32 precedence () const override {
-            return 800;
+        static value kernel (value a, value b) {
+            return *a > b;
         }
+    };
 
-        std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " && ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+    template <> struct operator_traits<stats::node::less> : operator_defaults {
+        static constexpr const char *Symbol = " < ";
+        static constexpr uint32 Precedence = 700;
+
+        static value kernel (value a, value b) {
+            return *a < b;
         }
+    };
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
+    template <> struct operator_traits<stats::node::boolean_and> : operator_defaults {
+        static constexpr const char *Symbol = " && ";
+        static constexpr uint32 Precedence = 800;
+
+        static value kernel (value a, value b) {
+            if (booleans (a, b)) return expression::boolean (truth (a) && truth (b));
             return *a && b;
-        };
+        }
     };
 
-    struct boolean_or : expression {
-        value Left;
-        value Right;
-        boolean_or (const value &a, const value &b) : Left {a}, Right {b} {}
+    template <> struct operator_traits<stats::node::boolean_or> : operator_defaults {
+        static constexpr const char *Symbol = " || ";
+        static constexpr uint32 Precedence = 900;
 
-        uint32 precedence () const override {
-            return 900;
+        static value kernel (value a, value b) {
+            if (booleans (a, b)) return expression::boolean (truth (a) || truth (b));
+            return *a || b;
         }
+    };
 
-        std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " || ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+    template <> struct operator_traits<stats::node::arrow> : operator_defaults {
+        static constexpr const char *Symbol = " -> ";
+        static constexpr uint32 Precedence = 1000;
+
+        static value kernel (value a, value b) {
+            return a->arrow (b);
         }
+    };
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return *a || b;
-        };
+    template <> struct operator_traits<stats::node::intuitionistic_and> : operator_defaults {
+        static constexpr const char *Symbol = " & ";
+        static constexpr uint32 Precedence = 1100;
+
+        static value kernel (value a, value b) {
+            return *a & b;
+        }
+    };
+
+    template <> struct operator_traits<stats::node::intuitionistic_or> : operator_defaults {
+        static constexpr const char *Symbol = " | ";
+        static constexpr uint32 Precedence = 1200;
+
+        static value kernel (value a, value b) {
+            return *a | b;
+        }
+    };
+
+    template <> struct operator_traits<stats::node::intuitionistic_implies> : operator_defaults {
+        static constexpr const char *Symbol = " => ";
+        static constexpr uint32 Precedence = 1300;
+
+        static value kernel (value a, value b) {
+            return a->implies (b);
+        }
+    };
+
+    // A chain of additions and subtractions, or of multiplications, is
+    // evaluated all at once. If every term is a rational number, we use an
+    // accumulator rather than reducing each intermediate result. Otherwise,
+    // the terms are combined the way the expression says.
+    struct chain {
+        stats::node Operation;
+        std::vector<ref<const expression>> Terms;
+        std::vector<bool> Negative;
+        bool Rational {true};
+        // the first term that is an error, after which we stop.
+        ref<const expression> Error {nullptr};
+
+        // the terms are known to be rationals or errors, so we need not check.
+        bool Proven;
+
+        chain (stats::node op, bool proven = false) : Operation {op}, Terms {}, Negative {}, Proven {proven} {}
+
+        bool contains (value v) const {
+            if (v == nullptr) return false;
+            if (Operation == stats::node::times) return v->kind () == stats::node::times;
+            return v->kind () == stats::node::plus || v->kind () == stats::node::minus;
+        }
+
+        void gather (value v, bool negative, const scope &vars) {
+            if (Error != nullptr) return;
+            if (!contains (v)) {
+                Terms.push_back (Diophant::evaluate (v, vars));
+                if (is_error (Terms.back ())) Error = Terms.back ();
+                Negative.push_back (negative);
+                if (!Proven) Rational = Rational && Terms.back () != nullptr && Terms.back ()->kind () == stats::node::rational;
+                return;
+            }
+
+            const auto &b = static_cast<const binary_operation &> (*v);
+            gather (b.Left, negative, vars);
+            gather (b.Right, v->kind () == stats::node::minus ? !negative : negative, vars);
+        }
+
+        ref<const expression> fold (value v, size_t &i) const {
+            if (!contains (v)) return Terms[i++];
+
+            const auto &b = static_cast<const binary_operation &> (*v);
+            auto x = fold (b.Left, i);
+            auto y = fold (b.Right, i);
+            if (x == nullptr) return expression::apply (x, y);
+            switch (v->kind ()) {
+                case stats::node::plus: return operator_traits<stats::node::plus>::kernel (x, y);
+                case stats::node::minus: return operator_traits<stats::node::minus>::kernel (x, y);
+                default: return operator_traits<stats::node::times>::kernel (x, y);
+            }
+        }
+
+        value evaluate (value v, const scope &vars) {
+            gather (v, false, vars);
+            if (Error != nullptr) return Error;
+
+            if (Rational) {
+                std::vector<fraction> x;
+                x.reserve (Terms.size ());
+                for (size_t i = 0; i < Terms.size (); i++)
+                    x.emplace_back (static_cast<const rational &> (*Terms[i]).Value, bool (Negative[i]));
+                return expression::rational (Operation == stats::node::times ? product (std::move (x)) : sum (std::move (x)));
+            }
+
+            size_t i = 0;
+            return fold (v, i);
+        }
     };
 
-    struct arrow : expression {
-        value Left;
-        value Right;
-        arrow (const value &a, const value &b) : Left {a}, Right {b} {}
+    template <stats::node op> struct binary_op : binary_operation {
+        using traits = operator_traits<op>;
+
+        binary_op (const value &a, const value &b) : binary_operation {a, b} {}
+
+        stats::node kind () const override {
+            return op;
+        }
 
         uint32 precedence () const override {
-            return 1000;
+            return traits::Precedence;
         }
 
         std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
+            if (Left->precedence () >= precedence ()) Left->write (o << "(") << ")";
             else Left->write (o);
-            o << " -> ";
+            o << traits::Symbol;
             if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
             else return Right->write (o);
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return a->arrow (b);
+        value evaluate (const scope &vars) const override {
+            if constexpr (traits::Chain)
+                return chain {op == stats::node::times ? op : stats::node::plus}.evaluate (self (), vars);
+            else {
+                auto a = Diophant::evaluate (Left, vars);
+                if (is_error (a)) return a;
+                auto b = Diophant::evaluate (Right, vars);
+                if (is_error (b)) return b;
+                if constexpr (traits::Strict) if (a.get () == nullptr) return expression::apply (a, b);
+                return traits::kernel (a, b);
+            }
         };
     };
 
-    struct intuitionistic_and : expression {
-        value Left;
-        value Right;
-        intuitionistic_and (const value &a, const value &b) : Left {a}, Right {b} {}
+    using plus = binary_op<stats::node::plus>;
+    using minus = binary_op<stats::node::minus>;
+    using times = binary_op<stats::node::times>;
+    using power = binary_op<stats::node::power>;
+    using divide = binary_op<stats::node::divide>;
+    using equal = binary_op<stats::node::equal>;
+    using unequal = binary_op<stats::node::unequal>;
+    using greater_equal = binary_op<stats::node::greater_equal>;
+    using less_equal = binary_op<stats::node::less_equal>;
+    using greater = binary_op<stats::node::greater>;
+    using less = binary_op<stats::node::less>;
+    using boolean_and = binary_op<stats::node::boolean_and>;
+    using boolean_or = binary_op<stats::node::boolean_or>;
+    using arrow = binary_op<stats::node::arrow>;
+    using intuitionistic_and = binary_op<stats::node::intuitionistic_and>;
+    using intuitionistic_or = binary_op<stats::node::intuitionistic_or>;
+    using intuitionistic_implies = binary_op<stats::node::intuitionistic_implies>;
 
-        uint32 precedence () const override {
-            return 1100;
+    struct polynomial : expression {
+        sparse_polynomial Value;
+        polynomial (sparse_polynomial &&p) : Value {std::move (p)} {}
+
+        void freeze () const override {
+            if (frozen ()) return;
+            expression::freeze ();
+            for (const auto &[m, c] : Value.Terms)
+                for (const auto &f : m.Factors) f.first->freeze ();
         }
 
-        std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " & ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+        stats::node kind () const override {
+            return stats::node::polynomial;
         }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return *a & b;
-        };
-    };
+        bool identical (const expression &e) const override {
+            return Value == static_cast<const polynomial &> (e).Value;
+        }
 
-    struct intuitionistic_or : expression {
-        value Left;
-        value Right;
-        intuitionistic_or (const value &a, const value &b) : Left {a}, Right {b} {}
+        uint64 compute_hash () const override {
+            return combine (uint64 (kind ()), Value.hash ());
+        }
 
+        // a sum binds like +, and a single term like ^, since it may have * and ^ in it.
         uint32 precedence () const override {
-            return 1200;
+            return Value.Terms.size () > 1 ? operator_traits<stats::node::plus>::Precedence :
+                operator_traits<stats::node::power>::Precedence;
         }
 
         std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " | ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+            return Value.write (o);
         }
-
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return *a | b;
-        };
     };
 
-    struct intuitionistic_implies : expression {
-        value Left;
-        value Right;
-        intuitionistic_implies (const value &a, const value &b) : Left {a}, Right {b} {}
+    maybe<sparse_polynomial> as_polynomial (value v) {
+        if (v == nullptr) return {};
+        if (auto r = dynamic_ref_cast<const rational> (v); r != nullptr) return sparse_polynomial::constant (r->Value);
+        if (auto p = dynamic_ref_cast<const polynomial> (v); p != nullptr) return p->Value;
+        if (v->kind () == stats::node::symbol) return sparse_polynomial::atom (v);
+        return {};
+    }
 
-        uint32 precedence () const override {
-            return 1300;
-        }
+    // polynomials that are only a number or an atom are returned as such.
+    value make_polynomial (sparse_polynomial &&p) {
+        if (auto c = p.constant (); c) return expression::rational (*c);
+        if (auto a = p.atom (); a != nullptr) return a;
+        return make_ref<polynomial> (std::move (p));
+    }
 
-        std::ostream &write (std::ostream &o) const override {
-            if (Left->precedence () > precedence ()) Left->write (o << "(") << ")";
-            else Left->write (o);
-            o << " => ";
-            if (Right->precedence () > precedence ()) return Right->write (o << "(") << ")";
-            else return Right->write (o);
+    // an exponent that we can expand a polynomial to.
+    maybe<uint32> read_exponent (value v) {
+        auto r = dynamic_ref_cast<const rational> (v);
+        if (r == nullptr || r->Value.Denominator != 1) return {};
+        if (r->Value.Numerator < 0 || r->Value.Numerator > Z {int64 (std::numeric_limits<uint32>::max ())}) return {};
+        return uint32 (int64 (r->Value.Numerator));
+    }
+
+    // An exponent that would not fit in 32 bits is an error.
+    ref<const expression> polynomial_operation (stats::node op, value a, value b) try {
+        auto x = as_polynomial (a);
+        if (!x) return nullptr;
+
+        if (op == stats::node::negate) return make_polynomial (-*x);
+
+        auto y = as_polynomial (b);
+        if (!y) return nullptr;
+
+        switch (op) {
+            case stats::node::plus: return make_polynomial (*x + *y);
+            case stats::node::minus: return make_polynomial (*x - *y);
+            case stats::node::times: return make_polynomial (*x * *y);
+            // we can only divide by a nonzero number.
+            case stats::node::divide: {
+                auto c = y->constant ();
+                if (!c || *c == Q {Z {0}}) return nullptr;
+                return make_polynomial (*x * (Q {Z {1}} / math::nonzero<Q> {*c}));
+            }
+            case stats::node::power: {
+                auto n = read_exponent (b);
+                if (!n) return nullptr;
+                // the result could be far too big to compute, so we check first.
+                meter::reserve (x->power_size (*n));
+                return make_polynomial (x->pow (*n));
+            }
+            default: return nullptr;
         }
+    } catch (const exponent_overflow &e) {
+        return expression::error (e.what ());
+    }
 
-        value evaluate (const std::map<data::string, value> &vars) const override {
-            auto a = Diophant::evaluate (Left, vars);
-            auto b = Diophant::evaluate (Right, vars);
-            if (a.get () == nullptr) return expression::apply (a, b);
-            return a->implies (b);
-        };
-    };
+    void expression::freeze () const {
+        if (frozen ()) return;
+        freeze_count ();
+        for (size_t i = 0; i < arity (); i++) if (auto c = child (i); c != nullptr) c->freeze ();
+    }
 
-    value inline expression::null () {
+    value expression::null () {
         return value {nullptr};
     }
 
-    value inline expression::boolean (bool b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::boolean> (b));
+    value expression::boolean (bool b) {
+        return make_ref<Diophant::boolean> (b);
+    }
+
+    // every big number result goes through here.
+    value expression::rational (const Q &q) {
+        meter::bytes (size_of (q));
+        stats::number ();
+        return make_ref<Diophant::rational> (q);
+    }
+
+    value expression::symbol (const data::string &x) {
+        return make_ref<Diophant::symbol> (intern (x));
+    }
+
+    value expression::string (const data::string &str) {
+        return expression::string (rope {str});
+    }
+
+    value expression::string (const rope &str) {
+        return make_ref<Diophant::string> (str);
+    }
+
+    value expression::bytes (const data::bytes &b) {
+        meter::bytes (b.size ());
+        return make_ref<Diophant::bytes> (b);
+    }
+
+    value expression::error (const data::string &message) {
+        // error messages are mostly different from each other, so there is nothing to gain by interning them.
+        return make_ref<Diophant::error> (std::make_shared<const data::string> (message));
+    }
+
+    value expression::list (const data::list<value> &ls) {
+        return make_ref<Diophant::list> (ls);
     }
 
-    value inline expression::rational (const Q &q) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::rational> (q));
+    value expression::list (std::vector<ref<const expression>> &&ls) {
+        return make_ref<Diophant::list> (std::move (ls));
     }
 
-    value inline expression::symbol (const data::string &x) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::symbol> (x));
+    value expression::object (const data::list<entry<data::string, value>> &x) {
+        return make_ref<Diophant::object> (x);
     }
 
-    value inline expression::string (const data::string &str) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::string> (str));
+    value expression::object (const std::vector<data::string> &keys, std::vector<ref<const expression>> &&values) {
+        return make_ref<Diophant::object> (shape::make (keys), std::move (values));
     }
 
-    value inline expression::list (const data::list<value> &ls) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::list> (ls));
+    value expression::builtin (const data::string &name, std::function<value (value)> f, std::function<void (value)> prepare) {
+        return make_ref<Diophant::builtin> (name, f, prepare);
     }
 
-    value inline expression::object (const data::list<entry<data::string, value>> &x) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::object> (x));
+    value expression::apply (const value a, const value b) {
+        return make_ref<Diophant::apply> (a, b);
     }
 
-    value inline expression::apply (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::apply> (a, b));
+    value expression::operator () (const value x) const {
+        return apply (self (), x);
     }
 
-    value inline expression::operator () (const value x) const {
-        return apply (this->shared_from_this (), x);
+    value expression::part (const value a, const value b) {
+        return make_ref<Diophant::part> (a, b);
     }
 
-    value inline expression::negate (const value x) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::negate> (x));
+    value expression::part (const value x) const {
+        return part (self (), x);
     }
 
-    value inline expression::operator - () const {
-        return negate (this->shared_from_this ());
+    value expression::negate (const value x) {
+        return make_ref<Diophant::negate> (x);
     }
 
-    value inline expression::plus (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::plus> (a, b));
+    value expression::operator - () const {
+        if (auto m = modular_operation (stats::node::negate, self (), nullptr); m != nullptr) return m;
+        if (auto p = polynomial_operation (stats::node::negate, self (), nullptr); p != nullptr) return p;
+        return negate (self ());
     }
 
-    value inline expression::operator + (const value v) const {
-        return plus (this->shared_from_this (), v);
+    value expression::plus (const value a, const value b) {
+        return make_ref<Diophant::plus> (a, b);
     }
 
-    value inline expression::minus (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::minus> (a, b));
+    value expression::operator + (const value v) const {
+        if (auto m = modular_operation (stats::node::plus, self (), v); m != nullptr) return m;
+        if (auto p = polynomial_operation (stats::node::plus, self (), v); p != nullptr) return p;
+        return plus (self (), v);
     }
 
-    value inline expression::operator - (const value v) const {
-        return minus (this->shared_from_this (), v);
+    value expression::minus (const value a, const value b) {
+        return make_ref<Diophant::minus> (a, b);
     }
 
-    value inline expression::times (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::times> (a, b));
+    value expression::operator - (const value v) const {
+        if (auto m = modular_operation (stats::node::minus, self (), v); m != nullptr) return m;
+        if (auto p = polynomial_operation (stats::node::minus, self (), v); p != nullptr) return p;
+        return minus (self (), v);
     }
 
-    value inline expression::operator * (const value v) const {
-        return times (this->shared_from_this (), v);
+    value expression::times (const value a, const value b) {
+        return make_ref<Diophant::times> (a, b);
     }
 
-    value inline expression::divide (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::divide> (a, b));
+    value expression::operator * (const value v) const {
+        if (auto m = modular_operation (stats::node::times, self (), v); m != nullptr) return m;
+        if (auto p = polynomial_operation (stats::node::times, self (), v); p != nullptr) return p;
+        return times (self (), v);
     }
 
-    value inline expression::operator / (const value v) const {
-        return divide (this->shared_from_this (), v);
+    value expression::divide (const value a, const value b) {
+        return make_ref<Diophant::divide> (a, b);
     }
 
-    value inline expression::power (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::power> (a, b));
+    value expression::operator / (const value v) const {
+        if (auto m = modular_operation (stats::node::divide, self (), v); m != nullptr) return m;
+        if (auto p = polynomial_operation (stats::node::divide, self (), v); p != nullptr) return p;
+        return divide (self (), v);
     }
 
-    value inline expression::operator ^ (const value v) const {
-        return power (this->shared_from_this (), v);
+    value expression::power (const value a, const value b) {
+        return make_ref<Diophant::power> (a, b);
     }
 
-    value inline expression::equal (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::equal> (a, b));
+    value expression::operator ^ (const value v) const {
+        if (auto m = modular_operation (stats::node::power, self (), v); m != nullptr) return m;
+        if (auto p = polynomial_operation (stats::node::power, self (), v); p != nullptr) return p;
+        return power (self (), v);
     }
 
-    value inline expression::operator == (const value v) const {
-        return equal (this->shared_from_this (), v);
+    value expression::equal (const value a, const value b) {
+        return make_ref<Diophant::equal> (a, b);
     }
 
-    value inline expression::unequal (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::unequal> (a, b));
+    value expression::operator == (const value v) const {
+        return equal (self (), v);
     }
 
-    value inline expression::operator != (const value v) const {
-        return unequal (this->shared_from_this (), v);
+    value expression::unequal (const value a, const value b) {
+        return make_ref<Diophant::unequal> (a, b);
     }
 
-    value inline expression::greater_equal (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::greater_equal> (a, b));
+    value expression::operator != (const value v) const {
+        return unequal (self (), v);
     }
 
-    value inline expression::operator >= (const value v) const {
-        return greater_equal (this->shared_from_this (), v);
+    value expression::greater_equal (const value a, const value b) {
+        return make_ref<Diophant::greater_equal> (a, b);
     }
 
-    value inline expression::less_equal (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::less_equal> (a, b));
+    value expression::operator >= (const value v) const {
+        return greater_equal (self (), v);
     }
 
-    value inline expression::operator <= (const value v) const {
-        return less_equal (this->shared_from_this (), v);
+    value expression::less_equal (const value a, const value b) {
+        return make_ref<Diophant::less_equal> (a, b);
     }
 
-    value inline expression::greater (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::greater> (a, b));
+    value expression::operator <= (const value v) const {
+        return less_equal (self (), v);
     }
 
-    value inline expression::operator > (const value v) const {
-        return greater (this->shared_from_this (), v);
+    value expression::greater (const value a, const value b) {
+        return make_ref<Diophant::greater> (a, b);
     }
 
-    value inline expression::less (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::less> (a, b));
+    value expression::operator > (const value v) const {
+        return greater (self (), v);
     }
 
-    value inline expression::operator < (const value v) const {
-        return less (this->shared_from_this (), v);
+    value expression::less (const value a, const value b) {
+        return make_ref<Diophant::less> (a, b);
     }
 
-    value inline expression::boolean_not (const value x) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::boolean_not> (x));
+    value expression::operator < (const value v) const {
+        return less (self (), v);
     }
 
-    value inline expression::operator ! () const {
-        return boolean_not (this->shared_from_this ());
+    value expression::boolean_not (const value x) {
+        return make_ref<Diophant::boolean_not> (x);
     }
 
-    value inline expression::boolean_and (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::boolean_and> (a, b));
+    value expression::operator ! () const {
+        return boolean_not (self ());
     }
 
-    value inline expression::operator && (const value v) const {
-        return boolean_and (this->shared_from_this (), v);
+    value expression::boolean_and (const value a, const value b) {
+        return make_ref<Diophant::boolean_and> (a, b);
     }
 
-    value inline expression::boolean_or (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::boolean_or> (a, b));
+    value expression::operator && (const value v) const {
+        return boolean_and (self (), v);
     }
 
-    value inline expression::operator || (const value v) const {
-        return boolean_or (this->shared_from_this (), v);
+    value expression::boolean_or (const value a, const value b) {
+        return make_ref<Diophant::boolean_or> (a, b);
     }
 
-    value inline expression::arrow (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::arrow> (a, b));
+    value expression::operator || (const value v) const {
+        return boolean_or (self (), v);
     }
 
-    value inline expression::arrow (const value v) const {
-        return arrow (this->shared_from_this (), v);
+    value expression::arrow (const value a, const value b) {
+        return make_ref<Diophant::arrow> (a, b);
     }
 
-    value inline expression::intuitionistic_and (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::intuitionistic_and> (a, b));
+    value expression::arrow (const value v) const {
+        return arrow (self (), v);
     }
 
-    value inline expression::operator & (const value v) const {
-        return intuitionistic_and (this->shared_from_this (), v);
+    value expression::intuitionistic_and (const value a, const value b) {
+        return make_ref<Diophant::intuitionistic_and> (a, b);
     }
 
-    value inline expression::intuitionistic_or (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::intuitionistic_or> (a, b));
+    value expression::operator & (const value v) const {
+        return intuitionistic_and (self (), v);
     }
 
-    value inline expression::operator | (const value v) const {
-        return intuitionistic_or (this->shared_from_this (), v);
+    value expression::intuitionistic_or (const value a, const value b) {
+        return make_ref<Diophant::intuitionistic_or> (a, b);
     }
 
-    value inline expression::intuitionistic_implies (const value a, const value b) {
-        return std::static_pointer_cast<expression> (std::make_shared<Diophant::intuitionistic_implies> (a, b));
+    value expression::operator | (const value v) const {
+        return intuitionistic_or (self (), v);
     }
 
-    value inline expression::implies (const value v) const {
-        return intuitionistic_implies (this->shared_from_this (), v);
+    value expression::intuitionistic_implies (const value a, const value b) {
+        return make_ref<Diophant::intuitionistic_implies> (a, b);
+    }
+
+    value expression::implies (const value v) const {
+        return intuitionistic_implies (self (), v);
     }
 
     value inline operator - (const value v) {
-        if (auto p = std::dynamic_pointer_cast<const rational> (v); p != nullptr)
+        if (auto p = dynamic_ref_cast<const rational> (v); p != nullptr)
             return expression::rational (-p->Value);
 
-        throw exception {} << "invalid operation";
+        return expression::error ("invalid operation");
     }
 
     value inline operator + (const value v, const value w) {
-        auto a = std::dynamic_pointer_cast<const rational> (v);
-        auto b = std::dynamic_pointer_cast<const rational> (w);
+        auto a = dynamic_ref_cast<const rational> (v);
+        auto b = dynamic_ref_cast<const rational> (w);
         if (a != nullptr && b != nullptr) return expression::rational (a->Value + b->Value);
 
-        throw exception {} << "invalid operation";
+        return expression::error ("invalid operation");
     }
 
     value inline operator - (const value v, const value w) {
-        auto a = std::dynamic_pointer_cast<const rational> (v);
-        auto b = std::dynamic_pointer_cast<const rational> (w);
+        auto a = dynamic_ref_cast<const rational> (v);
+        auto b = dynamic_ref_cast<const rational> (w);
         if (a != nullptr && b != nullptr) return expression::rational (a->Value - b->Value);
 
-        throw exception {} << "invalid operation";
+        return expression::error ("invalid operation");
     }
 
     value inline operator * (const value v, const value w) {
-        auto a = std::dynamic_pointer_cast<const rational> (v);
-        auto b = std::dynamic_pointer_cast<const rational> (w);
+        auto a = dynamic_ref_cast<const rational> (v);
+        auto b = dynamic_ref_cast<const rational> (w);
         if (a != nullptr && b != nullptr) return expression::rational (a->Value * b->Value);
 
-        throw exception {} << "invalid operation";
+        return expression::error ("invalid operation");
     }
 
     value operator / (const value v, const value w) {
-        auto a = std::dynamic_pointer_cast<const rational> (v);
-        auto b = std::dynamic_pointer_cast<const rational> (w);
+        auto a = dynamic_ref_cast<const rational> (v);
+        auto b = dynamic_ref_cast<const rational> (w);
         if (a != nullptr && b != nullptr) return expression::rational (a->Value / math::nonzero<Q> {b->Value});
 
-        throw exception {} << "invalid operation";
+        return expression::error ("invalid operation");
     }
 
     value operator == (const value v, const value w) {
-        if (v.get () == nullptr && w.get () == nullptr) return expression::boolean (true);
-
-        auto ba = std::dynamic_pointer_cast<const boolean> (v);
-        auto bb = std::dynamic_pointer_cast<const boolean> (w);
-
-        if (ba != nullptr && bb != nullptr) return expression::boolean (ba->Value == bb->Value);
-
-        auto ra = std::dynamic_pointer_cast<const rational> (v);
-        auto rb = std::dynamic_pointer_cast<const rational> (w);
-
-        if (ra != nullptr && rb != nullptr) return expression::boolean (ra->Value == rb->Value);
-
-        throw exception {} << "invalid operation";
-
+        return expression::boolean (identical (v, w));
     }
 
     value inline operator != (const value v, const value w) {
-        if (v.get () == nullptr && w.get () == nullptr) return expression::boolean (false);
-
-        auto ba = std::dynamic_pointer_cast<const boolean> (v);
-        auto bb = std::dynamic_pointer_cast<const boolean> (w);
-
-        if (ba != nullptr && bb != nullptr) return expression::boolean (ba->Value != bb->Value);
-
-        auto ra = std::dynamic_pointer_cast<const rational> (v);
-        auto rb = std::dynamic_pointer_cast<const rational> (w);
-
-        if (ra != nullptr && rb != nullptr) return expression::boolean (ra->Value != rb->Value);
-
-        throw exception {} << "invalid operation";
+        return expression::boolean (!identical (v, w));
     }
 
     value inline operator <= (const value v, const value w) {
-        auto ra = std::dynamic_pointer_cast<const rational> (v);
-        auto rb = std::dynamic_pointer_cast<const rational> (w);
+        auto ra = dynamic_ref_cast<const rational> (v);
+        auto rb = dynamic_ref_cast<const rational> (w);
 
         if (ra != nullptr && rb != nullptr) return expression::boolean (ra->Value <= rb->Value);
 
-        throw exception {} << "invalid operation";
+        return expression::error ("invalid operation");
     }
 
     value inline operator >= (const value v, const value w) {
-        auto ra = std::dynamic_pointer_cast<const rational> (v);
-        auto rb = std::dynamic_pointer_cast<const rational> (w);
+        auto ra = dynamic_ref_cast<const rational> (v);
+        auto rb = dynamic_ref_cast<const rational> (w);
 
         if (ra != nullptr && rb != nullptr) return expression::boolean (ra->Value <= rb->Value);
 
-        throw exception {} << "invalid operation";
+        return expression::error ("invalid operation");
     }
 
     value inline operator < (const value v, const value w) {
-        auto ra = std::dynamic_pointer_cast<const rational> (v);
-        auto rb = std::dynamic_pointer_cast<const rational> (w);
+        auto ra = dynamic_ref_cast<const rational> (v);
+        auto rb = dynamic_ref_cast<const rational> (w);
 
         if (ra != nullptr && rb != nullptr) return expression::boolean (ra->Value < rb->Value);
 
-        throw exception {} << "invalid operation";
+        return expression::error ("invalid operation");
     }
 
     value inline operator > (const value v, const value w) {
-        auto ra = std::dynamic_pointer_cast<const rational> (v);
-        auto rb = std::dynamic_pointer_cast<const rational> (w);
+        auto ra = dynamic_ref_cast<const rational> (v);
+        auto rb = dynamic_ref_cast<const rational> (w);
 
         if (ra != nullptr && rb != nullptr) return expression::boolean (ra->Value < rb->Value);
 
-        throw exception {} << "invalid operation";
+        return expression::error ("invalid operation");
     }
 
     value inline operator && (const value v, const value w) {
-        auto a = std::dynamic_pointer_cast<const boolean> (v);
-        auto b = std::dynamic_pointer_cast<const boolean> (w);
+        auto a = dynamic_ref_cast<const boolean> (v);
+        auto b = dynamic_ref_cast<const boolean> (w);
         if (a != nullptr && b != nullptr) return expression::boolean (a->Value && b->Value);
 
-        throw exception {} << "invalid operation";
+        return expression::error ("invalid operation");
     }
 
     value inline operator || (const value v, const value w) {
-        auto a = std::dynamic_pointer_cast<const boolean> (v);
-        auto b = std::dynamic_pointer_cast<const boolean> (w);
+        auto a = dynamic_ref_cast<const boolean> (v);
+        auto b = dynamic_ref_cast<const boolean> (w);
         if (a != nullptr && b != nullptr) return expression::boolean (a->Value || b->Value);
 
-        throw exception {} << "invalid operation";
+        return expression::error ("invalid operation");
     }
 
+    // x := v defines x, or redefines it if it was already defined, in which
+    // case everything that depends on x will be evaluated again.
     void evaluation::set () {
-        auto v = std::dynamic_pointer_cast<const symbol> (first (rest (Stack)));
+        auto v = dynamic_ref_cast<const symbol> (first (rest (Stack)));
         if (v == nullptr) throw exception {} << "invalid operation";
-        const data::string &var = v->Name;
-        if (Vars.find (var) != Vars.end ()) throw exception {} << "variable " << var << " is already defined!";
         auto val = first (Stack);
-        Vars.insert (std::pair {var, val});
+        Vars.define (*v->Name, val);
+        Defined.emplace_back (*v->Name, val);
         Stack = prepend (rest (rest (Stack)), val);
     }
 
+    // A declaration is either x : T, which declares an unknown x of type T,
+    // x : T = v, which defines x, or e : T = r for any other expression e,
+    // which adds the rule that e is rewritten to r. Since a declaration is
+    // always a whole statement, the stack holds the left side, the type and,
+    // if there is one, the right side.
+    void evaluation::declare () {
+        bool defined = data::size (Stack) == 3;
+        auto right = defined ? first (Stack) : expression::null ();
+        if (defined) Stack = rest (Stack);
+        auto left = first (rest (Stack));
+        Stack = stack<value> {};
+
+        if (auto v = dynamic_ref_cast<const symbol> (left); v != nullptr) {
+            Vars.define (*v->Name, defined ? right : left);
+            Defined.emplace_back (*v->Name, defined ? right : left);
+            return;
+        }
+
+        if (!defined) throw exception {} << "rule " << left << " has no right side";
+        Added.push_back (Rules.add (left, right, Vars));
+    }
+
+    // Reductions over lists. A list of rationals is reduced with an
+    // accumulator; anything else is combined one element at a time.
+    value reduce (value v, stats::node op) {
+        auto ls = dynamic_ref_cast<const list> (v);
+        if (ls == nullptr) return expression::error ("cannot reduce " + v->write () + " because it is not a list");
+
+        const auto &x = ls->Value;
+        bool rational = std::all_of (x.begin (), x.end (), [] (const ref<const expression> &e) {
+            return e != nullptr && e->kind () == stats::node::rational;
+        });
+
+        if (rational) {
+            std::vector<fraction> f;
+            f.reserve (x.size ());
+            for (const auto &e : x) f.emplace_back (static_cast<const Diophant::rational &> (*e).Value);
+            return expression::rational (op == stats::node::times ? product (std::move (f)) : sum (std::move (f)));
+        }
+
+        ref<const expression> r = x.front ();
+        for (size_t i = 1; i < x.size (); i++) {
+            if (r == nullptr) return expression::error ("invalid operation");
+            if (is_error (r)) return r;
+            r = op == stats::node::times ? *r * x[i] : *r + x[i];
+        }
+
+        return r;
+    }
+
+    // Invert a modular number, or every number in a list of them. A list is
+    // inverted all at once, which takes about as long as three multiplications
+    // per number and a single inversion.
+    value invert (value v) {
+        if (auto m = dynamic_ref_cast<const modular> (v); m != nullptr) {
+            if (is_zero (m->Value)) return expression::error ("division by zero");
+            return make_modular (*m->Field, m->Field->invert (m->Value));
+        }
+
+        auto ls = dynamic_ref_cast<const list> (v);
+        if (ls == nullptr || ls->Value.empty () || ls->Value.front () == nullptr || ls->Value.front ()->kind () != stats::node::modular)
+            return expression::error ("cannot invert " + (v == nullptr ? data::string {"null"} : v->write ()));
+
+        const montgomery &f = *static_cast<const modular &> (*ls->Value.front ()).Field;
+        std::vector<uint256> x;
+        x.reserve (ls->Value.size ());
+        for (const auto &e : ls->Value) {
+            if (is_error (e)) return e;
+            auto m = lift (f, e);
+            if (is_error (m)) return m;
+            x.push_back (static_cast<const modular &> (*m).Value);
+        }
+
+        if (!f.invert (x.data (), x.size ())) return expression::error ("division by zero");
+
+        std::vector<ref<const expression>> r;
+        r.reserve (x.size ());
+        for (const auto &e : x) r.push_back (make_modular (f, e));
+        return expression::list (std::move (r));
+    }
+
+    maybe<Q> rational_value (value v) {
+        auto x = dynamic_ref_cast<const rational> (v);
+        if (x == nullptr) return {};
+        return x->Value;
+    }
+
+    maybe<data::string> error_message (value v) {
+        auto x = dynamic_ref_cast<const error> (v);
+        if (x == nullptr) return {};
+        return *x->Message;
+    }
+
+    maybe<data::bytes> bytes_value (value v) {
+        auto x = dynamic_ref_cast<const bytes> (v);
+        if (x == nullptr) return {};
+        return x->Value;
+    }
+
+    maybe<data::string> string_value (value v) {
+        auto x = dynamic_ref_cast<const string> (v);
+        if (x == nullptr) return {};
+        return x->Value.flatten ();
+    }
+
+    // Kernels for operands whose types have been proven, which therefore
+    // use them without looking at them first. Chains of rationals do not
+    // need kernels because they are evaluated with an accumulator.
+    template <stats::node op, type t> struct typed_kernel;
+
+    template <> struct typed_kernel<stats::node::divide, type::rational> {
+        static value kernel (value a, value b) {
+            if (number (b).Numerator == 0) return expression::error ("division by zero");
+            return expression::rational (number (a) / math::nonzero<Q> {number (b)});
+        }
+    };
+
+    template <> struct typed_kernel<stats::node::plus, type::string> {
+        static value kernel (value a, value b) {
+            return expression::string (static_cast<const string &> (*a).Value + static_cast<const string &> (*b).Value);
+        }
+    };
+
+    template <> struct typed_kernel<stats::node::boolean_and, type::boolean> {
+        static value kernel (value a, value b) {
+            return expression::boolean (truth (a) && truth (b));
+        }
+    };
+
+    template <> struct typed_kernel<stats::node::boolean_or, type::boolean> {
+        static value kernel (value a, value b) {
+            return expression::boolean (truth (a) || truth (b));
+        }
+    };
+
+    template <type t> bool inline same (value a, value b) {
+        if constexpr (t == type::rational) return number (a) == number (b);
+        else if constexpr (t == type::boolean) return truth (a) == truth (b);
+        else return static_cast<const string &> (*a).Value == static_cast<const string &> (*b).Value;
+    }
+
+    template <type t> struct typed_kernel<stats::node::equal, t> {
+        static value kernel (value a, value b) {
+            return expression::boolean (same<t> (a, b));
+        }
+    };
+
+    template <type t> struct typed_kernel<stats::node::unequal, t> {
+        static value kernel (value a, value b) {
+            return expression::boolean (!same<t> (a, b));
+        }
+    };
+
+    // A binary operation whose operands are both proven to have type t.
+    // It is written and compared like any other node of the same kind.
+    template <stats::node op, type t> struct typed_op final : binary_op<op> {
+        typed_op (const value &a, const value &b) : binary_op<op> {a, b} {}
+
+        value evaluate (const scope &vars) const override {
+            if constexpr (operator_traits<op>::Chain && t == type::rational)
+                return chain {op == stats::node::times ? op : stats::node::plus, true}.evaluate (this->self (), vars);
+            else {
+                auto a = Diophant::evaluate (this->Left, vars);
+                if (is_error (a)) return a;
+                auto b = Diophant::evaluate (this->Right, vars);
+                if (is_error (b)) return b;
+                return typed_kernel<op, t>::kernel (a, b);
+            }
+        };
+    };
+
+    struct typed_negate final : negate {
+        typed_negate (const value &v) : negate {v} {}
+
+        value evaluate (const scope &vars) const override {
+            auto v = Diophant::evaluate (Value, vars);
+            if (is_error (v)) return v;
+            return expression::rational (-number (v));
+        };
+    };
+
+    struct typed_not final : boolean_not {
+        typed_not (const value &v) : boolean_not {v} {}
+
+        value evaluate (const scope &vars) const override {
+            auto v = Diophant::evaluate (Value, vars);
+            if (is_error (v)) return v;
+            return expression::boolean (!truth (v));
+        };
+    };
+
+    // the type of an operation on operands of the given types.
+    type result (stats::node op, type a, type b = type::unknown) {
+        switch (op) {
+            case stats::node::negate: return a == type::rational ? a : type::unknown;
+            case stats::node::boolean_not: return a == type::boolean ? a : type::unknown;
+            case stats::node::plus: return a == b && (a == type::rational || a == type::string) ? a : type::unknown;
+            case stats::node::minus:
+            case stats::node::times:
+            case stats::node::divide: return a == type::rational && b == type::rational ? a : type::unknown;
+            // anything can be compared, and the answer is always true or false.
+            case stats::node::equal:
+            case stats::node::unequal: return type::boolean;
+            case stats::node::boolean_and:
+            case stats::node::boolean_or: return a == type::boolean && b == type::boolean ? a : type::unknown;
+            default: return type::unknown;
+        }
+    }
+
+    // a node for op that relies on the types of its operands, or nullptr if there is none.
+    value typed (stats::node op, const std::vector<ref<const expression>> &x, const std::vector<type> &t) {
+        if (x.size () == 1) {
+            if (op == stats::node::negate && t[0] == type::rational) return make_ref<typed_negate> (x[0]);
+            if (op == stats::node::boolean_not && t[0] == type::boolean) return make_ref<typed_not> (x[0]);
+            return nullptr;
+        }
+
+        if (x.size () != 2 || t[0] != t[1]) return nullptr;
+        switch (t[0]) {
+            case type::rational: switch (op) {
+                case stats::node::plus: return make_ref<typed_op<stats::node::plus, type::rational>> (x[0], x[1]);
+                case stats::node::minus: return make_ref<typed_op<stats::node::minus, type::rational>> (x[0], x[1]);
+                case stats::node::times: return make_ref<typed_op<stats::node::times, type::rational>> (x[0], x[1]);
+                case stats::node::divide: return make_ref<typed_op<stats::node::divide, type::rational>> (x[0], x[1]);
+                case stats::node::equal: return make_ref<typed_op<stats::node::equal, type::rational>> (x[0], x[1]);
+                case stats::node::unequal: return make_ref<typed_op<stats::node::unequal, type::rational>> (x[0], x[1]);
+                default: return nullptr;
+            }
+
+            case type::boolean: switch (op) {
+                case stats::node::boolean_and: return make_ref<typed_op<stats::node::boolean_and, type::boolean>> (x[0], x[1]);
+                case stats::node::boolean_or: return make_ref<typed_op<stats::node::boolean_or, type::boolean>> (x[0], x[1]);
+                case stats::node::equal: return make_ref<typed_op<stats::node::equal, type::boolean>> (x[0], x[1]);
+                case stats::node::unequal: return make_ref<typed_op<stats::node::unequal, type::boolean>> (x[0], x[1]);
+                default: return nullptr;
+            }
+
+            case type::string: switch (op) {
+                case stats::node::plus: return make_ref<typed_op<stats::node::plus, type::string>> (x[0], x[1]);
+                case stats::node::equal: return make_ref<typed_op<stats::node::equal, type::string>> (x[0], x[1]);
+                case stats::node::unequal: return make_ref<typed_op<stats::node::unequal, type::string>> (x[0], x[1]);
+                default: return nullptr;
+            }
+
+            default: return nullptr;
+        }
+    }
+
+    // Types are inferred from the leaves up. Comparisons other than == and
+    // != are not typed because they are symbolic unless the rewrite rules
+    // say otherwise.
+    struct inference {
+        const scope &Vars;
+        // the types of symbols that we have already seen, which are kept between statements.
+        typing &Symbols;
+        // symbols whose definitions we are looking at, so that we do not
+        // follow a circular definition forever.
+        std::set<data::string> Visiting {};
+
+        type of (value v) {
+            if (v == nullptr) return type::unknown;
+            switch (v->kind ()) {
+                case stats::node::rational: return type::rational;
+                case stats::node::boolean: return type::boolean;
+                case stats::node::string: return type::string;
+                case stats::node::symbol: return of (*static_cast<const symbol &> (*v).Name);
+                default: break;
+            }
+
+            if (v->arity () == 1) return result (v->kind (), of (v->child (0)));
+            if (v->arity () == 2) return result (v->kind (), of (v->child (0)), of (v->child (1)));
+            return type::unknown;
+        }
+
+        type of (const data::string &name) {
+            if (auto t = Symbols.find (name); t != Symbols.end ()) return t->second;
+
+            // an undefined symbol or an unknown could be anything.
+            auto x = Vars.find (name);
+            if (x == nullptr || *x == nullptr) return type::unknown;
+            if ((*x)->kind () == stats::node::symbol && (*x)->write () == name) return Symbols[name] = type::unknown;
+            if (!Visiting.insert (name).second) return type::unknown;
+
+            type t = of (*x);
+            Visiting.erase (name);
+            return Symbols[name] = t;
+        }
+
+        std::pair<value, type> specialize (value v) {
+            if (v == nullptr || v->arity () == 0) return {v, of (v)};
+
+            std::vector<ref<const expression>> x;
+            std::vector<type> t;
+            bool changed = false;
+            for (size_t i = 0; i < v->arity (); i++) {
+                auto [c, u] = specialize (v->child (i));
+                changed = changed || c != v->child (i);
+                x.push_back (c);
+                t.push_back (u);
+            }
+
+            type r = x.size () == 1 ? result (v->kind (), t[0]) : x.size () == 2 ? result (v->kind (), t[0], t[1]) : type::unknown;
+            if (r != type::unknown) if (auto n = typed (v->kind (), x, t); n != nullptr) return {n, r};
+            return {changed ? v->with (std::move (x)) : v, r};
+        }
+    };
+
+    value specialize (value v, const scope &vars) {
+        return inference {vars, vars.Memo.Types}.specialize (v).first;
+    }
+
+    // Hash a byte string or a string, or every element of a list of them.
+    // A list is hashed all at once so that long lists can be hashed in
+    // parallel.
+    value hash (hash_function f, value v) {
+        size_t size = digest_size (f);
+        auto result = [size] (const byte *d) -> value {
+            data::bytes b (size);
+            std::copy (d, d + size, b.begin ());
+            return expression::bytes (b);
+        };
+
+        auto ls = dynamic_ref_cast<const list> (v);
+        if (ls == nullptr) {
+            std::vector<std::string_view> in (1);
+            data::string text;
+            if (auto b = dynamic_ref_cast<const bytes> (v); b != nullptr) in[0] = b->view ();
+            else if (auto s = dynamic_ref_cast<const string> (v); s != nullptr) in[0] = text = s->Value.flatten ();
+            else return expression::error (data::string {"cannot apply "} + name (f) + " to " + (v == nullptr ? data::string {"null"} : v->write ()));
+
+            std::vector<byte> out (size);
+            digest (f, in[0], out.data ());
+            return result (out.data ());
+        }
+
+        // strings are copied into one place; the addresses do not move because we reserve first.
+        std::vector<std::string_view> in;
+        std::vector<data::string> texts;
+        in.reserve (ls->Value.size ());
+        texts.reserve (ls->Value.size ());
+        for (const auto &e : ls->Value) {
+            if (is_error (e)) return e;
+            if (auto b = dynamic_ref_cast<const bytes> (e); b != nullptr) in.push_back (b->view ());
+            else if (auto s = dynamic_ref_cast<const string> (e); s != nullptr) in.push_back (texts.emplace_back (s->Value.flatten ()));
+            else return expression::error (data::string {"cannot apply "} + name (f) + " to " + (e == nullptr ? data::string {"null"} : e->write ()));
+        }
+
+        std::vector<byte> out (in.size () * size);
+        digest (f, in, out.data ());
+
+        std::vector<ref<const expression>> r;
+        r.reserve (in.size ());
+        for (size_t i = 0; i < in.size (); i++) r.push_back (result (out.data () + i * size));
+        return expression::list (std::move (r));
+    }
+
+    // Look for functions applied to literals before we evaluate anything, so
+    // that they can begin their work together. This is how independent
+    // queries in one statement come to share a round trip to the database.
+    void prepare (value v, const scope &vars) {
+        if (v == nullptr) return;
+
+        if (v->kind () == stats::node::apply) {
+            const auto &a = static_cast<const apply &> (*v);
+            if (a.Left != nullptr && a.Left->kind () == stats::node::symbol && a.Right != nullptr && a.Right->arity () == 0 &&
+                a.Right->kind () != stats::node::symbol)
+                if (auto f = vars.find (a.Left->write ()); f != nullptr && *f != nullptr) (*f)->prepare (a.Right);
+        }
+
+        for (size_t i = 0; i < v->arity (); i++) prepare (v->child (i), vars);
+    }
+
+    void add_builtins (bindings &vars) {
+        vars.insert (std::pair {"sum", expression::builtin ("sum", [] (value v) -> value {
+            return reduce (v, stats::node::plus);
+        })});
+
+        vars.insert (std::pair {"product", expression::builtin ("product", [] (value v) -> value {
+            return reduce (v, stats::node::times);
+        })});
+
+        for (const montgomery *f : {&montgomery::secp256k1_p (), &montgomery::secp256k1_n ()})
+            vars.insert (std::pair {f->Name, expression::builtin (f->Name, [f] (value v) -> value {
+                return lift (*f, v);
+            })});
+
+        vars.insert (std::pair {"invert", expression::builtin ("invert", [] (value v) -> value {
+            return invert (v);
+        })});
+
+        for (hash_function f : {hash_function::sha256, hash_function::hash256, hash_function::ripemd160, hash_function::hash160})
+            vars.insert (std::pair {name (f), expression::builtin (name (f), [f] (value v) -> value {
+                return hash (f, v);
+            })});
+    }
+
 }
 
 namespace Cosmos {
 
-    void calc () {
+    ptr<Diophant::environment> standard_environment () {
+        static ptr<Diophant::environment> Standard = [] () {
+            Diophant::bindings vars {};
+
+            // defined symbols
+            vars.insert (std::pair {"null", Diophant::expression::null ()});
+            vars.insert (std::pair {"true", Diophant::expression::boolean (true)});
+            vars.insert (std::pair {"false", Diophant::expression::boolean (false)});
+
+            Diophant::add_builtins (vars);
+            return std::make_shared<Diophant::environment> (std::move (vars));
+        } ();
+
+        return Standard;
+    }
+
+    struct session::local {
+        Diophant::bindings Vars;
+        Diophant::memo Memo;
+        Diophant::rewriter Rules;
+    };
+
+    session::session () : session {standard_environment ()} {}
+
+    session::session (ptr<Diophant::environment> shared) :
+        Budget {Diophant::budget::standard ()}, Shared {shared}, Journal {}, Local {std::make_unique<local> ()} {
+        Diophant::add_standard_rules (Local->Rules);
+    }
+
+    // versions of the shared environment that we were the last to read can be freed now.
+    session::~session () {
+        Shared->reclaim ();
+    }
+
+    maybe<string> session::operator () (const string &statement) {
+        // versions that were replaced while we read them can be freed now that we are done.
+        Shared->reclaim ();
+
+        // anything that builtins keep for this statement is let go however we leave.
+        Diophant::statement current {};
+        Diophant::meter metered {Budget};
+        tao::pegtl::memory_input<> input (statement, "expression");
+
+        // the version of the shared environment that we read stays valid until we are done.
+        Diophant::epoch::guard reading {};
+        Diophant::scope vars {Shared->current (), Local->Vars, Local->Memo};
+        Diophant::evaluation eval {vars, Local->Rules};
+
+        // Definitions and rules are made as the statement is read, and
+        // they stay made if it fails afterwards, so we journal them however
+        // the statement ends.
+        auto record = [this, &eval] () {
+            if (Journal == nullptr) return;
+            for (const auto &[name, definition] : eval.Defined) Journal->define (name, definition->write ());
+            for (const auto &[left, right] : eval.Added) Journal->rule (left->write (), right->write ());
+        };
+
+        Diophant::ref<const Diophant::expression> v;
+        try {
+            {
+                Diophant::stats::timer parsing {&Diophant::stats::counters::Parse};
+                Diophant::trace::scope traced {"parse"};
+                tao::pegtl::parse<Diophant::parse::grammar, Diophant::eval_action, Diophant::eval_control> (input, eval);
+            }
+
+            // we evaluate only after the whole statement has been read.
+            if (data::size (eval.Stack) == 1) {
+                Diophant::stats::timer evaluating {&Diophant::stats::counters::Evaluate};
+                Diophant::trace::scope traced {"evaluate"};
+                auto e = Diophant::specialize (eval.Stack.first (), eval.Vars);
+                Diophant::prepare (e, eval.Vars);
+                v = Local->Rules.normalize (Diophant::evaluate (e, eval.Vars), eval.Vars);
+            }
+        } catch (...) {
+            // the error that the user sees is the one from the statement.
+            try {
+                record ();
+            } catch (...) {}
+            throw;
+        }
+
+        record ();
+        if (data::size (eval.Stack) != 1) return {};
+        if (auto e = Diophant::error_message (v); e) throw exception {} << *e;
+        if (v == nullptr) return string {"null"};
+        return v->write ();
+    }
+
+    Diophant::value session::read (const string &expression) {
+        tao::pegtl::memory_input<> input (expression, "expression");
+
+        Diophant::epoch::guard reading {};
+        Diophant::scope vars {Shared->current (), Local->Vars, Local->Memo};
+        Diophant::evaluation eval {vars, Local->Rules};
+
+        if (!tao::pegtl::parse<tao::pegtl::seq<Diophant::parse::expression, Diophant::parse::ws, tao::pegtl::eof>,
+            Diophant::eval_action, Diophant::eval_control> (input, eval) || data::size (eval.Stack) != 1)
+            throw exception {} << "could not read expression " << expression;
+
+        return eval.Stack.first ();
+    }
+
+    Diophant::program session::compile (const string &expression, const std::vector<string> &columns) {
+        Diophant::value v = read (expression);
+
+        Diophant::epoch::guard reading {};
+        Diophant::scope vars {Shared->current (), Local->Vars, Local->Memo};
+        return Diophant::program {v, std::vector<data::string> (columns.begin (), columns.end ()), vars};
+    }
+
+    void session::journal_to (ptr<journal> j) {
+        // Rules were journaled with their symbols resolved, so what is left
+        // of a symbol in them is either a variable or the name of a value in
+        // the shared environment, such as true. These are resolved again
+        // against the shared environment alone, so that a variable does not
+        // become one of our own definitions.
+        for (const auto &[left, right] : j->recovered_rules ()) {
+            Diophant::value l = read (left);
+            Diophant::value r = read (right);
+            Diophant::epoch::guard reading {};
+            Diophant::bindings local {};
+            Diophant::memo memo {};
+            Diophant::scope vars {Shared->current (), local, memo};
+            Local->Rules.add (l, r, vars);
+        }
+
+        for (const auto &[name, definition] : j->recovered ()) {
+            Diophant::value v = read (definition);
+            Diophant::epoch::guard reading {};
+            Diophant::scope vars {Shared->current (), Local->Vars, Local->Memo};
+            vars.define (name, v);
+        }
+
+        Journal = j;
+    }
+
+    void session::publish () {
+        Shared->define (Local->Vars);
+        Local->Vars.clear ();
+        Local->Memo.clear ();
+    }
+
+    bool evaluate (std::istream &statements, std::ostream &results) {
+        session s {};
+        std::string line;
+        while (std::getline (statements, line)) {
+            if (line.empty ()) continue;
+            try {
+                if (auto result = s (line); result) results << *result << "\n";
+            } catch (const std::exception &ex) {
+                std::cerr << "Error: " << ex.what () << std::endl;
+                return false;
+            }
+        }
+
+        results.flush ();
+        return true;
+    }
+
+    void calc (ptr<journal> j) {
         std::string input_str;
         std::cout << "\nCalculator app engaged! The calculator app supports rational arithmetic. You can also set variables." << std::endl;
 
-        std::map<string, Diophant::value> vars;
-
-        // defined symbols
-        vars.insert (std::pair {"null", Diophant::expression::null ()});
-        vars.insert (std::pair {"true", Diophant::expression::boolean (true)});
-        vars.insert (std::pair {"false", Diophant::expression::boolean (false)});
+        session s {};
+        if (j != nullptr) {
+            s.journal_to (j);
+            std::cout << "recovered " << j->recovered ().size () << " definitions and "
+                << j->recovered_rules ().size () << " rules" << std::endl;
+        }
 
         while (true) {
             std::cout << "\n input: ";
@@ -1403,13 +2667,36 @@ namespace Cosmos {
             if (!std::getline (std::cin, input_str)) break;
             if (input_str.empty ()) continue;
 
-            try {
-                tao::pegtl::memory_input<> input (input_str, "expression");
-                Diophant::evaluation eval {vars};
-                tao::pegtl::parse<Diophant::parse::grammar, Diophant::eval_action> (input, eval);
+            // meta commands
+            if (input_str == ":stats") {
+                Diophant::stats::write (std::cout) << std::endl;
+                continue;
+            }
 
+            if (input_str == ":publish") {
+                s.publish ();
+                continue;
+            }
 
+            if (input_str.starts_with (":trace ")) {
+                std::string arg = input_str.substr (7);
+                try {
+                    if (arg == "on") Diophant::trace::enable ();
+                    else if (arg == "off") Diophant::trace::disable ();
+                    else {
+                        std::ofstream file {arg};
+                        Diophant::trace::write (file);
+                        std::cout << "trace written to " << arg << std::endl;
+                    }
+                } catch (const std::exception& ex) {
+                    std::cerr << "Error: " << ex.what () << std::endl;
+                }
+
+                continue;
+            }
 
+            try {
+                if (auto result = s (input_str); result) std::cout << "\n result: " << *result << std::endl;
             } catch (const std::exception& ex) {
                 std::cerr << "Error: " << ex.what () << std::endl;
             }
@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "csv.hpp"
+#include "calc.hpp"
+
+namespace Cosmos {
+
+    namespace {
+
+        // a file mapped into memory for as long as this exists.
+        struct mapped {
+            const char *Begin {nullptr};
+            size_t Size {0};
+
+            mapped (const string &path) {
+                int fd = open (path.c_str (), O_RDONLY);
+                if (fd < 0) throw exception {} << "could not open " << path;
+
+                struct stat st;
+                if (fstat (fd, &st) != 0) {
+                    close (fd);
+                    throw exception {} << "could not read " << path;
+                }
+
+                Size = size_t (st.st_size);
+                if (Size > 0) {
+                    void *m = mmap (nullptr, Size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (m == MAP_FAILED) {
+                        close (fd);
+                        throw exception {} << "could not map " << path;
+                    }
+
+                    madvise (m, Size, MADV_SEQUENTIAL);
+                    Begin = static_cast<const char *> (m);
+                }
+
+                // the mapping remains after the file is closed.
+                close (fd);
+            }
+
+            ~mapped () {
+                if (Begin != nullptr) munmap (const_cast<char *> (Begin), Size);
+            }
+
+            mapped (const mapped &) = delete;
+            mapped &operator = (const mapped &) = delete;
+        };
+
+        const char *end_of_line (const char *p, const char *end) {
+            const char *n = static_cast<const char *> (memchr (p, '\n', end - p));
+            return n == nullptr ? end : n;
+        }
+
+        // remove spaces and a carriage return.
+        std::string_view trim (const char *b, const char *e) {
+            while (b < e && (*b == ' ' || *b == '\t')) b++;
+            while (e > b && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) e--;
+            return std::string_view {b, size_t (e - b)};
+        }
+
+        void read_field (std::string_view x, Diophant::column &c, size_t line) {
+            try {
+                Diophant::read_number (x, c);
+            } catch (const std::exception &e) {
+                throw exception {} << "line " << line << ": " << e.what ();
+            }
+        }
+
+        // the number of rows that are read before they are evaluated.
+        constexpr size_t Slice = 1 << 16;
+
+        // Read and evaluate the rows between begin and end, which are at the
+        // beginnings of lines, and write the results to out.
+        void evaluate (const Diophant::program &p, size_t columns, const char *begin, const char *end,
+            size_t first_line, std::string &out) {
+            std::vector<Diophant::column> values (columns);
+            std::vector<const Diophant::column *> pointers (columns, nullptr);
+            for (size_t j = 0; j < columns; j++) if (p.uses (j)) pointers[j] = &values[j];
+
+            size_t line = first_line;
+            const char *x = begin;
+            while (x < end) {
+                for (auto &c : values) c = Diophant::column {};
+                size_t rows = 0;
+
+                while (x < end && rows < Slice) {
+                    const char *eol = end_of_line (x, end);
+                    line++;
+
+                    // blank lines are not rows.
+                    if (trim (x, eol).empty ()) {
+                        x = eol == end ? end : eol + 1;
+                        continue;
+                    }
+
+                    size_t j = 0;
+                    const char *field = x;
+                    while (true) {
+                        const char *comma = static_cast<const char *> (memchr (field, ',', eol - field));
+                        const char *field_end = comma == nullptr ? eol : comma;
+                        if (j >= columns) throw exception {} << "line " << line << " has too many fields";
+                        if (p.uses (j)) read_field (trim (field, field_end), values[j], line);
+                        j++;
+                        if (comma == nullptr) break;
+                        field = comma + 1;
+                    }
+
+                    if (j != columns) throw exception {} << "line " << line << " has " << j << " fields but there are " << columns << " columns";
+
+                    rows++;
+                    x = eol == end ? end : eol + 1;
+                }
+
+                Diophant::write_lines (out, p.run (pointers, rows));
+            }
+        }
+
+        size_t count_lines (const char *begin, const char *end) {
+            return size_t (std::count (begin, end, '\n'));
+        }
+
+    }
+
+    void csv (const string &path, const string &expression, std::ostream &results) {
+        mapped file {path};
+        const char *begin = file.Begin;
+        const char *end = file.Begin + file.Size;
+        if (begin == end) throw exception {} << path << " is empty";
+
+        const char *header_end = end_of_line (begin, end);
+        std::vector<string> names;
+        for (const char *field = begin; ; ) {
+            const char *comma = static_cast<const char *> (memchr (field, ',', header_end - field));
+            const char *field_end = comma == nullptr ? header_end : comma;
+            names.push_back (string {std::string {trim (field, field_end)}});
+            if (comma == nullptr) break;
+            field = comma + 1;
+        }
+
+        session s {};
+        Diophant::program p = s.compile (expression, names);
+
+        // split the rest into chunks that begin at the beginnings of lines.
+        const char *data = std::min (header_end + 1, end);
+        size_t chunks = std::max (size_t (std::thread::hardware_concurrency ()), size_t (1));
+        size_t size = size_t (end - data);
+        std::vector<const char *> bounds {data};
+        for (size_t i = 1; i < chunks; i++) {
+            const char *b = std::max (bounds.back (), data + size * i / chunks);
+            if (b > data && b < end && b[-1] != '\n') b = std::min (end_of_line (b, end) + 1, end);
+            bounds.push_back (std::min (b, end));
+        }
+
+        bounds.push_back (end);
+
+        std::vector<std::string> outputs (chunks);
+        std::vector<std::exception_ptr> errors (chunks);
+        std::vector<std::thread> threads;
+        threads.reserve (chunks);
+
+        // the line on which each chunk begins, for error messages.
+        size_t line = 1;
+        for (size_t i = 0; i < chunks; i++) {
+            threads.emplace_back ([&, i, line] () {
+                try {
+                    evaluate (p, names.size (), bounds[i], bounds[i + 1], line, outputs[i]);
+                } catch (...) {
+                    errors[i] = std::current_exception ();
+                }
+            });
+
+            line += count_lines (bounds[i], bounds[i + 1]);
+        }
+
+        // Each chunk is written as soon as it and every chunk before it are
+        // done, and then let go. After an error we write nothing more, but
+        // we still wait for every thread.
+        std::exception_ptr error {};
+        for (size_t i = 0; i < chunks; i++) {
+            threads[i].join ();
+            if (error) continue;
+            if (errors[i]) {
+                error = errors[i];
+                continue;
+            }
+
+            results.write (outputs[i].data (), std::streamsize (outputs[i].size ()));
+            results.flush ();
+            std::string {}.swap (outputs[i]);
+        }
+
+        if (error) std::rethrow_exception (error);
+    }
+
+}
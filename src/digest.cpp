@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <exception>
+#include <new>
+#include <thread>
+
+#include <openssl/evp.h>
+
+#include "digest.hpp"
+
+namespace Diophant {
+
+    namespace {
+
+        // lists shorter than this are not worth starting threads for.
+        constexpr size_t Parallel = 1 << 10;
+
+        constexpr size_t SHA256Size = 32;
+        constexpr size_t RIPEMD160Size = 20;
+
+        // A digest context for each thread, which is reused for every
+        // digest the thread computes rather than allocated each time.
+        struct context {
+            EVP_MD_CTX *Context;
+
+            context () : Context {EVP_MD_CTX_new ()} {
+                if (Context == nullptr) throw std::bad_alloc {};
+            }
+
+            ~context () {
+                EVP_MD_CTX_free (Context);
+            }
+
+            context (const context &) = delete;
+            context &operator = (const context &) = delete;
+
+            void digest (const EVP_MD *md, const void *x, size_t size, byte *out) {
+                if (EVP_DigestInit_ex (Context, md, nullptr) != 1 ||
+                    EVP_DigestUpdate (Context, x, size) != 1 ||
+                    EVP_DigestFinal_ex (Context, out, nullptr) != 1)
+                    throw exception {} << "could not compute a digest";
+            }
+        };
+
+        context &local () {
+            thread_local context Context {};
+            return Context;
+        }
+
+    }
+
+    const char *name (hash_function f) {
+        switch (f) {
+            case hash_function::sha256: return "sha256";
+            case hash_function::hash256: return "hash256";
+            case hash_function::ripemd160: return "ripemd160";
+            default: return "hash160";
+        }
+    }
+
+    size_t digest_size (hash_function f) {
+        return f == hash_function::sha256 || f == hash_function::hash256 ? SHA256Size : RIPEMD160Size;
+    }
+
+    void digest (hash_function f, std::string_view x, byte *out) {
+        context &c = local ();
+        byte first[SHA256Size];
+        switch (f) {
+            case hash_function::sha256:
+                c.digest (EVP_sha256 (), x.data (), x.size (), out);
+                return;
+            case hash_function::hash256:
+                c.digest (EVP_sha256 (), x.data (), x.size (), first);
+                c.digest (EVP_sha256 (), first, SHA256Size, out);
+                return;
+            case hash_function::ripemd160:
+                c.digest (EVP_ripemd160 (), x.data (), x.size (), out);
+                return;
+            default:
+                c.digest (EVP_sha256 (), x.data (), x.size (), first);
+                c.digest (EVP_ripemd160 (), first, SHA256Size, out);
+        }
+    }
+
+    void digest (hash_function f, const std::vector<std::string_view> &x, byte *out) {
+        size_t size = digest_size (f);
+        auto range = [&] (size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) digest (f, x[i], out + i * size);
+        };
+
+        size_t threads = std::min<size_t> (std::max<unsigned> (std::thread::hardware_concurrency (), 1), x.size () / Parallel);
+        if (threads < 2) return range (0, x.size ());
+
+        // each thread takes a contiguous part of the list, and this one takes the last.
+        std::vector<std::thread> workers;
+        std::vector<std::exception_ptr> errors (threads);
+        size_t part = x.size () / threads;
+        for (size_t t = 0; t + 1 < threads; t++) workers.emplace_back ([&, t] () {
+            try {
+                range (t * part, (t + 1) * part);
+            } catch (...) {
+                errors[t] = std::current_exception ();
+            }
+        });
+
+        try {
+            range ((threads - 1) * part, x.size ());
+        } catch (...) {
+            errors[threads - 1] = std::current_exception ();
+        }
+
+        for (auto &w : workers) w.join ();
+        for (auto &e : errors) if (e) std::rethrow_exception (e);
+    }
+
+}
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "environment.hpp"
+
+namespace Diophant {
+
+    namespace epoch {
+
+        namespace {
+
+            constexpr uint64 Idle = std::numeric_limits<uint64>::max ();
+
+            // the first epoch is 1 so that retiring in epoch 0 is never possible.
+            std::atomic<uint64> Current {1};
+
+            // each on its own cache line so that readers do not share lines.
+            struct alignas (64) slot {
+                std::atomic<uint64> Epoch {Idle};
+                std::atomic<bool> Taken {true};
+            };
+
+            std::mutex Mutex;
+
+            // Slots are never freed, so readers may be checked at any time.
+            // A slot whose thread has exited is taken by the next new thread.
+            std::vector<std::unique_ptr<slot>> Slots;
+
+            slot *take () {
+                std::lock_guard<std::mutex> lock (Mutex);
+                for (auto &s : Slots) {
+                    bool taken = false;
+                    if (s->Taken.compare_exchange_strong (taken, true)) return s.get ();
+                }
+
+                Slots.push_back (std::make_unique<slot> ());
+                return Slots.back ().get ();
+            }
+
+            struct reader {
+                slot *Slot;
+                uint32 Depth;
+
+                reader () : Slot {take ()}, Depth {0} {}
+
+                ~reader () {
+                    Slot->Epoch.store (Idle, std::memory_order_release);
+                    Slot->Taken.store (false, std::memory_order_release);
+                }
+            };
+
+            reader &local () {
+                thread_local reader Local {};
+                return Local;
+            }
+
+        }
+
+        // The announcement must be visible before we read anything it
+        // protects, so these operations are sequentially consistent.
+        guard::guard () {
+            reader &r = local ();
+            if (r.Depth++ == 0) r.Slot->Epoch.store (Current.load ());
+        }
+
+        guard::~guard () {
+            reader &r = local ();
+            if (--r.Depth == 0) r.Slot->Epoch.store (Idle, std::memory_order_release);
+        }
+
+        uint64 advance () {
+            return Current.fetch_add (1);
+        }
+
+        uint64 oldest () {
+            uint64 e = Idle;
+            std::lock_guard<std::mutex> lock (Mutex);
+            for (const auto &s : Slots) e = std::min (e, s->Epoch.load ());
+            return e;
+        }
+
+    }
+
+    namespace {
+
+        // numbers of snapshots and generations of memos, starting at 1.
+        std::atomic<uint64> Numbers {1};
+
+        uint64 next_number () {
+            return Numbers.fetch_add (1, std::memory_order_relaxed);
+        }
+
+        // values must be frozen before other threads can see them.
+        void freeze (const bindings &b) {
+            for (const auto &[name, v] : b) if (v != nullptr) v->freeze ();
+        }
+
+    }
+
+    environment::environment (bindings &&b) : Current {new snapshot {std::move (b), next_number ()}} {
+        freeze (Current.load ()->Values);
+    }
+
+    environment::~environment () {
+        // nobody can be reading an environment that is being destroyed.
+        delete Current.load ();
+        for (const auto &[b, e] : Retired) delete b;
+    }
+
+    const snapshot &environment::current () const {
+        return *Current.load ();
+    }
+
+    void environment::define (const bindings &x) {
+        std::lock_guard<std::mutex> lock (Writing);
+        freeze (x);
+
+        const snapshot *old = Current.load ();
+        auto next = new snapshot {old->Values, next_number ()};
+        for (const auto &[name, v] : x) {
+            // values are const, so we cannot assign to them.
+            next->Values.erase (name);
+            next->Values.insert (std::pair {name, v});
+        }
+
+        Current.store (next);
+        Version.fetch_add (1, std::memory_order_relaxed);
+
+        // a reader that began in the epoch that is ending may still see the old version.
+        Retired.emplace_back (old, epoch::advance ());
+        free_retired ();
+    }
+
+    // readers call this, so they must not wait for each other.
+    void environment::reclaim () {
+        if (Retiring.load (std::memory_order_relaxed) == 0) return;
+        std::unique_lock<std::mutex> lock (Writing, std::try_to_lock);
+        if (lock.owns_lock ()) free_retired ();
+    }
+
+    void environment::free_retired () {
+        uint64 oldest = epoch::oldest ();
+        std::erase_if (Retired, [oldest] (const std::pair<const snapshot *, uint64> &r) {
+            if (r.second >= oldest) return false;
+            delete r.first;
+            return true;
+        });
+
+        Retiring.store (Retired.size (), std::memory_order_relaxed);
+    }
+
+    memo::memo () : Generation {next_number ()} {}
+
+    void memo::clear () {
+        Entries.clear ();
+        Types.clear ();
+        Generation = next_number ();
+    }
+
+    // the types of dependents are not recorded, so we forget them all.
+    void memo::invalidate (const data::string &name) {
+        Types.clear ();
+        Generation = next_number ();
+        std::vector<data::string> todo {name};
+        while (!todo.empty ()) {
+            auto e = Entries.find (todo.back ());
+            todo.pop_back ();
+            if (e == Entries.end ()) continue;
+
+            e->second.Value = nullptr;
+            e->second.Known = false;
+
+            // dependents record themselves again when they are evaluated.
+            todo.insert (todo.end (), e->second.Dependents.begin (), e->second.Dependents.end ());
+            e->second.Dependents.clear ();
+        }
+    }
+
+    scope::scope (const snapshot &shared, bindings &local, memo &m) : Shared {shared.Values}, Local {local}, Memo {m} {
+        // anything in the shared environment could have changed.
+        if (Memo.Shared != shared.Number) {
+            Memo.clear ();
+            Memo.Shared = shared.Number;
+        }
+    }
+
+    const ref<const expression> *scope::find (const data::string &name) const {
+        if (auto x = Local.find (name); x != Local.end ()) return &x->second;
+        if (auto x = Shared.find (name); x != Shared.end ()) return &x->second;
+        return nullptr;
+    }
+
+    value scope::evaluate (const data::string &name) const {
+        // a definition that uses an undefined symbol depends on it too, so
+        // that it is evaluated again once the symbol is defined.
+        if (!Memo.Computing.empty ()) Memo.Entries[name].Dependents.insert (Memo.Computing.back ());
+
+        auto x = find (name);
+        if (x == nullptr) return expression::error ("undefined symbol " + name);
+
+        // an unknown is bound to itself.
+        if (*x != nullptr && (*x)->kind () == stats::node::symbol && (*x)->write () == name) return *x;
+
+        // only a session's own definitions are remembered.
+        if (Local.find (name) == Local.end ()) return Diophant::evaluate (*x, *this);
+
+        memo::entry &e = Memo.Entries[name];
+        if (e.Known) return e.Value;
+        if (e.Computing) return expression::error ("definition of " + name + " is circular");
+
+        e.Computing = true;
+        Memo.Computing.push_back (name);
+        ref<const expression> v;
+        try {
+            v = Diophant::evaluate (*x, *this);
+        } catch (...) {
+            e.Computing = false;
+            Memo.Computing.pop_back ();
+            throw;
+        }
+
+        e.Computing = false;
+        Memo.Computing.pop_back ();
+        e.Value = v;
+        e.Known = true;
+        return v;
+    }
+
+    void scope::define (const data::string &name, value v) {
+        Local.erase (name);
+        Local.insert (std::pair {name, v});
+        Memo.invalidate (name);
+    }
+
+}
@@ -0,0 +1,71 @@
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+
+#include "http.hpp"
+#include "stats.hpp"
+
+namespace Cosmos {
+
+    namespace asio = boost::asio;
+    namespace beast = boost::beast;
+    namespace http = beast::http;
+    using tcp = asio::ip::tcp;
+
+    http::response<http::string_body> respond (const http::request<http::string_body> &req) {
+        http::response<http::string_body> res;
+        res.version (req.version ());
+        res.keep_alive (false);
+
+        if (req.method () == http::verb::get && req.target () == "/metrics") {
+            std::stringstream ss;
+            Diophant::stats::write_prometheus (ss);
+            res.result (http::status::ok);
+            res.set (http::field::content_type, "text/plain; version=0.0.4");
+            res.body () = ss.str ();
+        } else {
+            res.result (http::status::not_found);
+            res.set (http::field::content_type, "text/plain");
+            res.body () = "not found\n";
+        }
+
+        res.prepare_payload ();
+        return res;
+    }
+
+    void listen (uint16 port) {
+        asio::io_context io;
+        tcp::acceptor acceptor {io, tcp::endpoint {tcp::v4 (), port}};
+
+        while (true) {
+            tcp::socket socket {io};
+            acceptor.accept (socket);
+
+            try {
+                beast::flat_buffer buffer;
+                http::request<http::string_body> req;
+                http::read (socket, buffer, req);
+                http::write (socket, respond (req));
+                socket.shutdown (tcp::socket::shutdown_send);
+            } catch (const std::exception &ex) {
+                std::cerr << "HTTP error: " << ex.what () << std::endl;
+            }
+        }
+    }
+
+    void start_http_listener (uint16 port) {
+        std::thread {[port] () {
+            try {
+                listen (port);
+            } catch (const std::exception &ex) {
+                std::cerr << "HTTP listener on port " << port << " stopped: " << ex.what () << std::endl;
+            }
+        }}.detach ();
+
+        std::cerr << "HTTP listener started on port " << port << std::endl;
+    }
+
+}
@@ -0,0 +1,228 @@
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "journal.hpp"
+#include "hash.hpp"
+
+namespace Cosmos {
+
+    namespace {
+
+        // the first bytes of every journal.
+        const std::string Magic {"NODEJRNL"};
+
+        // the file is not compacted until it has at least this many superseded records.
+        constexpr size_t Slack = 1 << 10;
+
+        void write_number (std::string &out, uint64 x, size_t size) {
+            for (size_t i = 0; i < size; i++) out.push_back (char ((x >> (8 * i)) & 0xff));
+        }
+
+        uint64 read_number (const std::string &in, size_t at, size_t size) {
+            uint64 x = 0;
+            for (size_t i = 0; i < size; i++) x |= uint64 (uint8 (in[at + i])) << (8 * i);
+            return x;
+        }
+
+        using record = journal::record;
+        using kind = journal::kind;
+
+        uint64 checksum (const record &r) {
+            char k = char (r.Kind);
+            return Diophant::hash_bytes (r.Second, Diophant::hash_bytes (r.First, Diophant::hash_bytes (std::string_view {&k, 1})));
+        }
+
+        // A record is its kind in one byte, the sizes of its two parts in
+        // four bytes each, the two parts and an eight-byte checksum. The
+        // parts of a definition are the name and the definition, and those
+        // of a rule are its left and right sides.
+        void encode (std::string &out, const record &r) {
+            out.push_back (char (r.Kind));
+            write_number (out, r.First.size (), 4);
+            write_number (out, r.Second.size (), 4);
+            out += r.First;
+            out += r.Second;
+            write_number (out, checksum (r), 8);
+        }
+
+        // Read the record at the given position and move past it, or return
+        // nothing if it is incomplete or damaged.
+        maybe<record> decode (const std::string &in, size_t &at) {
+            if (in.size () - at < 9) return {};
+            kind k = kind (in[at]);
+            if (k != kind::definition && k != kind::rule) return {};
+            size_t n = read_number (in, at + 1, 4);
+            size_t d = read_number (in, at + 5, 4);
+            if (in.size () - at - 9 < n + d + 8) return {};
+
+            record r {k, string {in.substr (at + 9, n)}, string {in.substr (at + 9 + n, d)}};
+            if (read_number (in, at + 9 + n + d, 8) != checksum (r)) return {};
+
+            at += 9 + n + d + 8;
+            return r;
+        }
+
+        void write_all (int file, const std::string &x) {
+            size_t written = 0;
+            while (written < x.size ()) {
+                ssize_t w = ::write (file, x.data () + written, x.size () - written);
+                if (w < 0 && errno == EINTR) continue;
+                if (w < 0) throw exception {} << std::strerror (errno);
+                written += size_t (w);
+            }
+        }
+
+        void sync (int file) {
+            if (::fdatasync (file) != 0) throw exception {} << std::strerror (errno);
+        }
+
+    }
+
+    journal::journal (const string &path, std::chrono::milliseconds interval) :
+        Path {path}, Interval {interval}, File {-1}, Recovered {}, RecoveredRules {}, Latest {}, Rules {}, Records {0},
+        Mutex {}, Stop {}, Pending {}, Stopping {false}, Failed {}, Writer {} {
+
+        std::ifstream in {Path, std::ios::binary};
+        std::string x {std::istreambuf_iterator<char> {in}, std::istreambuf_iterator<char> {}};
+
+        // the program stopped before it had written the first bytes.
+        if (x.size () < Magic.size () && Magic.starts_with (x)) x.clear ();
+
+        size_t end = Magic.size ();
+        if (!x.empty ()) {
+            if (!x.starts_with (Magic)) throw exception {} << Path << " is not a journal";
+            while (auto r = decode (x, end)) {
+                keep (*r);
+                Records++;
+            }
+        }
+
+        File = ::open (Path.c_str (), O_WRONLY | O_CREAT, 0644);
+        if (File < 0) throw exception {} << "could not open journal " << Path << ": " << std::strerror (errno);
+
+        if (x.empty ()) write_all (File, Magic);
+        if (::ftruncate (File, off_t (end)) != 0 || ::lseek (File, off_t (end), SEEK_SET) < 0) {
+            ::close (File);
+            throw exception {} << "could not recover journal " << Path << ": " << std::strerror (errno);
+        }
+
+        Recovered = Latest;
+        RecoveredRules = Rules;
+        Writer = std::thread {[this] () {
+            write ();
+        }};
+    }
+
+    journal::~journal () {
+        {
+            std::lock_guard<std::mutex> lock {Mutex};
+            Stopping = true;
+        }
+
+        Stop.notify_all ();
+        Writer.join ();
+        ::close (File);
+    }
+
+    void journal::define (const string &name, const string &definition) {
+        std::lock_guard<std::mutex> lock {Mutex};
+        if (Failed) throw exception {} << "could not write journal " << Path << ": " << *Failed;
+        Pending.push_back (record {kind::definition, name, definition});
+    }
+
+    void journal::rule (const string &left, const string &right) {
+        std::lock_guard<std::mutex> lock {Mutex};
+        if (Failed) throw exception {} << "could not write journal " << Path << ": " << *Failed;
+        Pending.push_back (record {kind::rule, left, right});
+    }
+
+    void journal::keep (const record &r) {
+        if (r.Kind == kind::definition) Latest[r.First] = r.Second;
+        else Rules.emplace_back (r.First, r.Second);
+    }
+
+    // Once something goes wrong we stop writing, because a journal with
+    // a gap in it could recover the wrong definitions.
+    void journal::write () {
+        while (true) {
+            std::vector<record> batch;
+            bool stopping;
+            {
+                std::unique_lock<std::mutex> lock {Mutex};
+                Stop.wait_for (lock, Interval, [this] () {
+                    return Stopping;
+                });
+
+                std::swap (batch, Pending);
+                stopping = Stopping;
+            }
+
+            try {
+                if (!batch.empty ()) append (batch);
+                if (Records > 2 * (Latest.size () + Rules.size ()) + Slack) compact ();
+            } catch (const std::exception &e) {
+                std::lock_guard<std::mutex> lock {Mutex};
+                Failed = string {e.what ()};
+                return;
+            }
+
+            if (stopping) return;
+        }
+    }
+
+    void journal::append (const std::vector<record> &batch) {
+        std::string out;
+        for (const auto &r : batch) {
+            encode (out, r);
+            keep (r);
+        }
+
+        write_all (File, out);
+        sync (File);
+        Records += batch.size ();
+    }
+
+    // The new file is complete and synced before it replaces the old one,
+    // so a crash leaves one or the other.
+    void journal::compact () {
+        std::string out = Magic;
+        for (const auto &[name, definition] : Latest) encode (out, record {kind::definition, name, definition});
+        for (const auto &[left, right] : Rules) encode (out, record {kind::rule, left, right});
+
+        string temporary = Path + ".compact";
+        int file = ::open (temporary.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file < 0) throw exception {} << std::strerror (errno);
+
+        try {
+            write_all (file, out);
+            sync (file);
+        } catch (...) {
+            ::close (file);
+            throw;
+        }
+
+        if (std::rename (temporary.c_str (), Path.c_str ()) != 0) {
+            ::close (file);
+            throw exception {} << std::strerror (errno);
+        }
+
+        // the rename is only durable once the directory is synced.
+        auto directory = std::filesystem::path {std::string {Path}}.parent_path ();
+        int d = ::open (directory.empty () ? "." : directory.c_str (), O_RDONLY | O_DIRECTORY);
+        if (d >= 0) {
+            ::fsync (d);
+            ::close (d);
+        }
+
+        ::close (File);
+        File = file;
+        Records = Latest.size () + Rules.size ();
+    }
+
+}
@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <vector>
+
+#include "modular.hpp"
+
+namespace Diophant {
+
+    namespace {
+
+        using uint128 = unsigned __int128;
+
+        // all ones if the bit is set, otherwise zero.
+        uint64 inline mask (uint64 bit) {
+            return uint64 (0) - bit;
+        }
+
+        // x + y, returning the carry.
+        uint64 add_with_carry (uint256 &r, const uint256 &x, const uint256 &y) {
+            uint128 c = 0;
+            for (int i = 0; i < 4; i++) {
+                c += uint128 (x[i]) + y[i];
+                r[i] = uint64 (c);
+                c >>= 64;
+            }
+
+            return uint64 (c);
+        }
+
+        // x - y, returning the borrow.
+        uint64 subtract_with_borrow (uint256 &r, const uint256 &x, const uint256 &y) {
+            uint64 borrow = 0;
+            for (int i = 0; i < 4; i++) {
+                uint128 d = uint128 (x[i]) - y[i] - borrow;
+                r[i] = uint64 (d);
+                borrow = uint64 (d >> 64) & 1;
+            }
+
+            return borrow;
+        }
+
+        // x if the mask is zero, y if it is all ones.
+        uint256 select (uint64 m, const uint256 &x, const uint256 &y) {
+            uint256 r;
+            for (int i = 0; i < 4; i++) r[i] = x[i] ^ (m & (x[i] ^ y[i]));
+            return r;
+        }
+
+        // (x, carry) is less than 2m, so we subtract m at most once.
+        uint256 reduce (const uint256 &x, uint64 carry, const uint256 &m) {
+            uint256 d;
+            uint64 borrow = subtract_with_borrow (d, x, m);
+            return select (mask (carry | (borrow ^ 1)), x, d);
+        }
+
+        void swap (uint64 m, uint256 &x, uint256 &y) {
+            for (int i = 0; i < 4; i++) {
+                uint64 t = m & (x[i] ^ y[i]);
+                x[i] ^= t;
+                y[i] ^= t;
+            }
+        }
+
+    }
+
+    montgomery::montgomery (const uint256 &modulus, const char *name) :
+        Name {name}, Modulus {modulus}, Inverse {1}, One {1, 0, 0, 0}, R2 {}, MinusTwo {} {
+
+        // Newton's method doubles the number of correct bits each time.
+        for (int i = 0; i < 6; i++) Inverse *= 2 - Modulus[0] * Inverse;
+        Inverse = uint64 (0) - Inverse;
+
+        // 1 doubled 256 times is 2^256 mod m, and doubled 256 more is 2^512.
+        for (int i = 0; i < 256; i++) One = add (One, One);
+        R2 = One;
+        for (int i = 0; i < 256; i++) R2 = add (R2, R2);
+
+        subtract_with_borrow (MinusTwo, Modulus, uint256 {2, 0, 0, 0});
+    }
+
+    uint256 montgomery::add (const uint256 &x, const uint256 &y) const {
+        uint256 r;
+        uint64 carry = add_with_carry (r, x, y);
+        return reduce (r, carry, Modulus);
+    }
+
+    uint256 montgomery::subtract (const uint256 &x, const uint256 &y) const {
+        uint256 r;
+        uint64 borrow = subtract_with_borrow (r, x, y);
+        uint256 m = select (mask (borrow), zero (), Modulus);
+        add_with_carry (r, r, m);
+        return r;
+    }
+
+    uint256 montgomery::negate (const uint256 &x) const {
+        return subtract (zero (), x);
+    }
+
+    // Multiply and reduce one limb at a time, so that the intermediate
+    // result is never more than six limbs.
+    uint256 montgomery::multiply (const uint256 &x, const uint256 &y) const {
+        uint64 t[6] = {0, 0, 0, 0, 0, 0};
+        for (int i = 0; i < 4; i++) {
+            uint128 c = 0;
+            for (int j = 0; j < 4; j++) {
+                c += uint128 (x[j]) * y[i] + t[j];
+                t[j] = uint64 (c);
+                c >>= 64;
+            }
+
+            c += t[4];
+            t[4] = uint64 (c);
+            t[5] = uint64 (c >> 64);
+
+            // add a multiple of m that makes the lowest limb zero and drop it.
+            uint64 q = t[0] * Inverse;
+            c = uint128 (q) * Modulus[0] + t[0];
+            c >>= 64;
+            for (int j = 1; j < 4; j++) {
+                c += uint128 (q) * Modulus[j] + t[j];
+                t[j - 1] = uint64 (c);
+                c >>= 64;
+            }
+
+            c += t[4];
+            t[3] = uint64 (c);
+            t[4] = t[5] + uint64 (c >> 64);
+        }
+
+        return reduce (uint256 {t[0], t[1], t[2], t[3]}, t[4], Modulus);
+    }
+
+    uint256 montgomery::in (const uint256 &x) const {
+        return multiply (x, R2);
+    }
+
+    uint256 montgomery::out (const uint256 &x) const {
+        return multiply (x, uint256 {1, 0, 0, 0});
+    }
+
+    // a Montgomery ladder, which does the same work for every bit of the exponent.
+    uint256 montgomery::pow (const uint256 &x, const uint256 &exponent) const {
+        uint256 a = One;
+        uint256 b = x;
+        for (int i = 255; i >= 0; i--) {
+            uint64 m = mask ((exponent[i / 64] >> (i % 64)) & 1);
+            swap (m, a, b);
+            b = multiply (a, b);
+            a = multiply (a, a);
+            swap (m, a, b);
+        }
+
+        return a;
+    }
+
+    uint256 montgomery::invert (const uint256 &x) const {
+        return pow (x, MinusTwo);
+    }
+
+    bool montgomery::invert (uint256 *x, size_t size) const {
+        if (size == 0) return true;
+        if (std::any_of (x, x + size, [] (const uint256 &v) {
+            return is_zero (v);
+        })) return false;
+
+        // products of every prefix.
+        std::vector<uint256> prefix (size);
+        prefix[0] = x[0];
+        for (size_t i = 1; i < size; i++) prefix[i] = multiply (prefix[i - 1], x[i]);
+
+        // the inverse of every prefix, from the longest down.
+        uint256 inverse = invert (prefix[size - 1]);
+        for (size_t i = size - 1; i > 0; i--) {
+            uint256 next = multiply (inverse, x[i]);
+            x[i] = multiply (inverse, prefix[i - 1]);
+            inverse = next;
+        }
+
+        x[0] = inverse;
+        return true;
+    }
+
+    uint256 montgomery::read (std::string_view digits) const {
+        uint256 ten = in (uint256 {10, 0, 0, 0});
+        uint256 r = zero ();
+        for (char d : digits) r = add (multiply (r, ten), in (uint256 {uint64 (d - '0'), 0, 0, 0}));
+        return r;
+    }
+
+    data::string montgomery::write (const uint256 &x) const {
+        uint256 v = out (x);
+        if (is_zero (v)) return "0";
+
+        std::string digits;
+        while (!is_zero (v)) {
+            uint128 remainder = 0;
+            for (int i = 3; i >= 0; i--) {
+                uint128 n = (remainder << 64) | v[i];
+                v[i] = uint64 (n / 10);
+                remainder = n % 10;
+            }
+
+            digits.push_back (char ('0' + int (remainder)));
+        }
+
+        std::reverse (digits.begin (), digits.end ());
+        return digits;
+    }
+
+    const montgomery &montgomery::secp256k1_p () {
+        static montgomery P {{0xFFFFFFFEFFFFFC2F, 0xFFFFFFFFFFFFFFFF, 0xFFFFFFFFFFFFFFFF, 0xFFFFFFFFFFFFFFFF}, "modp"};
+        return P;
+    }
+
+    const montgomery &montgomery::secp256k1_n () {
+        static montgomery N {{0xBFD25E8CD0364141, 0xBAAEDCE6AF48A03B, 0xFFFFFFFFFFFFFFFE, 0xFFFFFFFFFFFFFFFF}, "modn"};
+        return N;
+    }
+
+}
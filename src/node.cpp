@@ -1,6 +1,9 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
 
 #include "program_options.hpp"
+#include "benchmark.hpp"
 
 namespace Cosmos {
 
@@ -11,10 +14,24 @@ namespace Cosmos {
         "option --env. In then searches for options, first in the command line and then in the env file, if one "
         "was found."
         "\nIt then searches for a postgres database url to connect to given by option \"db_url\". If one is "
-        "found, it tries to connect to the database."
+        "found, it tries to connect to the database, after which the calculator can run SQL with "
+        "query \"select ...\"."
         "\nIt searches for option \"http_listener_port\". If an option is found, an HTTP server is started on "
         "the given port."
-        "\nThe command line becomes a calculator app.";
+        "\nThe command line becomes a calculator app."
+        "\nWith option --eval \"<statement>\", the program instead evaluates the statement, writes the result "
+        "and exits. Option --file <path> does the same for a file of statements, one per line, or for standard "
+        "input if the path is -. The database is only connected to if a statement runs a query."
+        "\nWith options --csv <path> --expr \"<expression>\", the program evaluates the expression for each row of "
+        "a CSV file, in parallel, with each column bound to the symbol named in the first line."
+        "\nWith options --query \"<sql>\" --expr \"<expression>\", the program evaluates the expression for each row "
+        "of the result of the query, which is streamed from the database. With option --into <table>, the results "
+        "are copied into the table instead of being written."
+        "\nOptions max_steps, max_nodes, max_bytes and time_limit_ms limit what any one statement may use."
+        "\nWith option journal, the calculator records every definition in the given file and recovers them "
+        "from it when it starts. The file is synced every journal_interval_ms milliseconds, 100 by default."
+        "\nWith option --benchmark, the program instead measures how evaluation scales with the size of its input "
+        "and exits with an error if anything grows faster than expected.";
 
     const char *Version = "version 0.0.0";
 
@@ -24,17 +41,20 @@ int main (int arg_count, char ** arg_values) {
 
     argh::parser command_line_parser;
 
+    // these take whole statements as values.
+    command_line_parser.add_params ({"--eval", "--file", "--csv", "--expr", "--query", "--into"});
     command_line_parser.parse (arg_count, arg_values);
 
     // display version.
     if (command_line_parser[{"--version"}]) std::cout << Cosmos::Version << std::endl;
     // display help.
     else if (command_line_parser[{"--help"}]) std::cout << Cosmos::Version << "\n" << Cosmos::Help << std::endl;
+    // run benchmarks.
+    else if (command_line_parser[{"--benchmark"}]) return Cosmos::benchmark (std::cout) ? 0 : 1;
     // otherwise, run the program normally.
     else
         try {
-            std::cout << "Welcome to node." << std::endl;
-            run (Cosmos::program_options::read (command_line_parser));
+            return run (Cosmos::program_options::read (command_line_parser));
         } catch (std::exception &exception) {
             std::cerr << exception.what () << std::endl;
             return 1;
@@ -44,29 +64,61 @@ int main (int arg_count, char ** arg_values) {
 }
 
 #include "calc.hpp"
+#include "http.hpp"
+#include "environment.hpp"
+#include "csv.hpp"
+#include "stream.hpp"
+#include "journal.hpp"
 
 namespace Cosmos {
 
-    void run (const program_options &opts) {
+    int run (const program_options &opts) {
 
-        // try to connect to database
-        // we don't do anything with the database so we just
-        // forget about it after words.
+        Diophant::budget::standard () = opts.Budget;
+
+        if (opts.HTTPListenerPort) start_http_listener (*opts.HTTPListenerPort);
+
+        // Every session can run queries with the query builtin. We connect
+        // on a background thread so as not to hold up anything else, and in
+        // one-shot mode we do not connect at all unless there is a query.
         if (opts.DatabaseURL) {
+            if (!opts.one_shot ()) std::cout << "database url: " << *opts.DatabaseURL << std::endl;
+
+            auto db = std::make_shared<database> (*opts.DatabaseURL);
+            if (!opts.one_shot ()) db->connect ();
+
+            Diophant::bindings query {};
+            query.insert (std::pair {"query", query_builtin (db)});
+            standard_environment ()->define (query);
+        }
+
+        if (opts.Eval) {
+            std::stringstream statements {*opts.Eval};
+            return evaluate (statements, std::cout) ? 0 : 1;
+        }
+
+        if (opts.CSV) {
+            csv (*opts.CSV, *opts.Expression, std::cout);
+            return 0;
+        }
+
+        if (opts.Query) {
+            if (!opts.DatabaseURL) throw exception {} << "option --query needs a database URL";
+            stream (*opts.DatabaseURL, *opts.Query, *opts.Expression, opts.Into, std::cout);
+            return 0;
+        }
 
-            std::cout << "database url: " << *opts.DatabaseURL << std::endl;
-            
-            ptr<pqxx::connection> connection = connect_to_database (*opts.DatabaseURL);
+        if (opts.File) {
+            if (*opts.File == "-") return evaluate (std::cin, std::cout) ? 0 : 1;
 
-            if (connection->is_open ()) {
-                std::cout << "Connected to the database!" << std::endl;
-                //connection->close ();
-            } else {
-                std::cout << "Cannot connect to the database." << std::endl;
-            }
+            std::ifstream statements {*opts.File};
+            if (!statements) throw exception {} << "could not open " << *opts.File;
+            return evaluate (statements, std::cout) ? 0 : 1;
         }
 
-        calc ();
+        std::cout << "Welcome to node." << std::endl;
+        calc (opts.Journal ? std::make_shared<journal> (*opts.Journal, opts.JournalInterval) : nullptr);
+        return 0;
 
     }
 }
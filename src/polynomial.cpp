@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <sstream>
+#include <utility>
+
+#include "polynomial.hpp"
+
+namespace Diophant {
+
+    namespace {
+
+        // a total order on atoms which is the same in every run of the program.
+        bool atom_less (value a, value b) {
+            if (a->hash () != b->hash ()) return a->hash () < b->hash ();
+            return a->write () < b->write ();
+        }
+
+        std::ostream &write_coefficient (std::ostream &o, const Q &q) {
+            if (q.Denominator == 1) return o << q.Numerator;
+            return o << "(" << q.Numerator << "/" << q.Denominator << ")";
+        }
+
+        uint32 add_exponents (uint32 a, uint32 b) {
+            uint32 r;
+            if (__builtin_add_overflow (a, b, &r)) throw exponent_overflow {};
+            return r;
+        }
+
+        constexpr uint64 Saturated = std::numeric_limits<uint64>::max ();
+
+        uint64 saturating_multiply (uint64 a, uint64 b) {
+            uint64 r;
+            return __builtin_mul_overflow (a, b, &r) ? Saturated : r;
+        }
+
+        // (n + k) choose k. This at least doubles at each step while i <= n,
+        // so it saturates within 64 steps if it is too big.
+        uint64 choose (uint64 n, uint64 k) {
+            if (k > n) std::swap (n, k);
+            uint64 r = 1;
+            for (uint64 i = 1; i <= k; i++) {
+                r = saturating_multiply (r, n + i);
+                if (r == Saturated) return r;
+                r /= i;
+            }
+
+            return r;
+        }
+
+        const Q &zero () {
+            static Q Zero {Z {0}};
+            return Zero;
+        }
+
+    }
+
+    monomial monomial::atom (value v) {
+        monomial m {};
+        m.Factors.emplace_back (v, 1);
+        return m;
+    }
+
+    uint64 monomial::degree () const {
+        uint64 d = 0;
+        for (const auto &f : Factors) d += f.second;
+        return d;
+    }
+
+    // both lists of factors are sorted, so we merge them.
+    monomial monomial::operator * (const monomial &m) const {
+        monomial x {};
+        x.Factors.reserve (Factors.size () + m.Factors.size ());
+
+        auto a = Factors.begin ();
+        auto b = m.Factors.begin ();
+        while (a != Factors.end () && b != m.Factors.end ()) {
+            if (identical (a->first, b->first)) {
+                x.Factors.emplace_back (a->first, add_exponents (a->second, b->second));
+                a++;
+                b++;
+            } else if (atom_less (a->first, b->first)) x.Factors.push_back (*a++);
+            else x.Factors.push_back (*b++);
+        }
+
+        x.Factors.insert (x.Factors.end (), a, Factors.end ());
+        x.Factors.insert (x.Factors.end (), b, m.Factors.end ());
+        return x;
+    }
+
+    bool monomial::operator == (const monomial &m) const {
+        if (Factors.size () != m.Factors.size ()) return false;
+        for (size_t i = 0; i < Factors.size (); i++)
+            if (Factors[i].second != m.Factors[i].second || !identical (Factors[i].first, m.Factors[i].first)) return false;
+        return true;
+    }
+
+    uint64 monomial::hash () const {
+        uint64 h = 0x6d6f6e6f;
+        for (const auto &f : Factors) h = combine (combine (h, f.first->hash ()), f.second);
+        return h;
+    }
+
+    // * binds more tightly than ^, so a power in a product is written in parentheses.
+    std::ostream &monomial::write (std::ostream &o) const {
+        bool product = Factors.size () > 1;
+        bool first = true;
+        for (const auto &[a, n] : Factors) {
+            if (!first) o << " * ";
+            first = false;
+
+            bool power = n != 1;
+            if (power && product) o << "(";
+
+            // an atom is written in parentheses unless it is as tight as an application.
+            if (a->precedence () > 100) a->write (o << "(") << ")";
+            else a->write (o);
+
+            if (power) o << " ^ " << n;
+            if (power && product) o << ")";
+        }
+
+        return o;
+    }
+
+    sparse_polynomial sparse_polynomial::constant (const Q &q) {
+        sparse_polynomial p {};
+        p.add (monomial {}, q);
+        return p;
+    }
+
+    sparse_polynomial sparse_polynomial::atom (value v) {
+        sparse_polynomial p {};
+        p.Terms.emplace (monomial::atom (v), Q {Z {1}});
+        return p;
+    }
+
+    maybe<Q> sparse_polynomial::constant () const {
+        if (Terms.empty ()) return zero ();
+        if (Terms.size () == 1 && Terms.begin ()->first.Factors.empty ()) return Terms.begin ()->second;
+        return {};
+    }
+
+    ref<const expression> sparse_polynomial::atom () const {
+        if (Terms.size () != 1) return nullptr;
+        const auto &[m, c] = *Terms.begin ();
+        if (c != Q {Z {1}} || m.Factors.size () != 1 || m.Factors[0].second != 1) return nullptr;
+        return m.Factors[0].first;
+    }
+
+    void sparse_polynomial::add (const monomial &m, const Q &q) {
+        if (q == zero ()) return;
+        auto [t, inserted] = Terms.try_emplace (m, q);
+        if (inserted) return;
+        t->second = t->second + q;
+        if (t->second == zero ()) Terms.erase (t);
+    }
+
+    sparse_polynomial sparse_polynomial::operator - () const {
+        sparse_polynomial p {};
+        for (const auto &[m, c] : Terms) p.Terms.emplace (m, -c);
+        return p;
+    }
+
+    sparse_polynomial sparse_polynomial::operator + (const sparse_polynomial &x) const {
+        sparse_polynomial p = *this;
+        for (const auto &[m, c] : x.Terms) {
+            meter::step ();
+            p.add (m, c);
+        }
+        return p;
+    }
+
+    sparse_polynomial sparse_polynomial::operator - (const sparse_polynomial &x) const {
+        sparse_polynomial p = *this;
+        for (const auto &[m, c] : x.Terms) {
+            meter::step ();
+            p.add (m, -c);
+        }
+        return p;
+    }
+
+    sparse_polynomial sparse_polynomial::operator * (const sparse_polynomial &x) const {
+        sparse_polynomial p {};
+        for (const auto &[m, c] : Terms)
+            for (const auto &[n, d] : x.Terms) {
+                meter::step ();
+                p.add (m * n, c * d);
+            }
+        return p;
+    }
+
+    sparse_polynomial sparse_polynomial::operator * (const Q &q) const {
+        sparse_polynomial p {};
+        if (q == zero ()) return p;
+        for (const auto &[m, c] : Terms) {
+            meter::step ();
+            p.Terms.emplace (m, c * q);
+        }
+        return p;
+    }
+
+    sparse_polynomial sparse_polynomial::pow (uint32 n) const {
+        sparse_polynomial p = constant (Q {Z {1}});
+        sparse_polynomial x = *this;
+        while (n > 0) {
+            if (n & 1) p = p * x;
+            n >>= 1;
+            if (n > 0) x = x * x;
+        }
+
+        return p;
+    }
+
+    bool sparse_polynomial::operator == (const sparse_polynomial &x) const {
+        if (Terms.size () != x.Terms.size ()) return false;
+        for (const auto &[m, c] : Terms) {
+            auto t = x.Terms.find (m);
+            if (t == x.Terms.end () || t->second != c) return false;
+        }
+
+        return true;
+    }
+
+    // terms are combined with addition so that the order of the map does not matter.
+    uint64 sparse_polynomial::hash () const {
+        uint64 h = 0;
+        for (const auto &[m, c] : Terms) h += mix (combine (m.hash (), hash_number (c, 0)));
+        return h;
+    }
+
+    uint64 sparse_polynomial::size () const {
+        uint64 n = 0;
+        for (const auto &[m, c] : Terms) n += size_of (c);
+        return n;
+    }
+
+    // p^n has at most (n + t - 1) choose n terms, where p has t terms. Each
+    // coefficient is a sum of products of n coefficients of p times
+    // multinomial coefficients, which are at most t^n.
+    uint64 sparse_polynomial::power_size (uint32 n) const {
+        if (Terms.empty () || n == 0) return 0;
+
+        uint64 largest = 0;
+        for (const auto &[m, c] : Terms) largest = std::max (largest, size_of (c));
+
+        uint64 terms = choose (Terms.size () - 1, n);
+        uint64 digits = largest + std::bit_width (Terms.size ()) / 8 + 1;
+        return saturating_multiply (terms, saturating_multiply (n, digits));
+    }
+
+    std::ostream &sparse_polynomial::write (std::ostream &o) const {
+        if (Terms.empty ()) return o << "0";
+
+        struct term {
+            const monomial *Monomial;
+            const Q *Coefficient;
+            data::string Written;
+        };
+
+        std::vector<term> terms;
+        for (const auto &[m, c] : Terms) {
+            std::stringstream ss;
+            m.write (ss);
+            terms.push_back (term {&m, &c, ss.str ()});
+        }
+
+        std::sort (terms.begin (), terms.end (), [] (const term &a, const term &b) {
+            uint64 da = a.Monomial->degree ();
+            uint64 db = b.Monomial->degree ();
+            if (da != db) return da > db;
+            return a.Written < b.Written;
+        });
+
+        auto negative = [] (const term &t) {
+            return *t.Coefficient < zero ();
+        };
+
+        // a term without its sign. A lone power is put in parentheses if
+        // anything comes before it, since -x ^ 2 is read as (-x) ^ 2.
+        auto write_term = [&o] (const term &t, bool signed_term) {
+            Q c = *t.Coefficient < zero () ? -*t.Coefficient : *t.Coefficient;
+            bool one = c == Q {Z {1}};
+            bool power = t.Monomial->Factors.size () == 1 && t.Monomial->Factors[0].second != 1;
+
+            if (t.Monomial->Factors.empty ()) write_coefficient (o, c);
+            else if (one && !signed_term) o << t.Written;
+            else {
+                if (!one) write_coefficient (o, c) << " * ";
+                if (power) o << "(" << t.Written << ")";
+                else o << t.Written;
+            }
+        };
+
+        if (negative (terms[0])) o << "-";
+        write_term (terms[0], negative (terms[0]));
+
+        // a - b - c would be read as a - (b - c), so a run of negative
+        // terms is written as a - (b + c).
+        for (size_t i = 1; i < terms.size ();) {
+            if (!negative (terms[i])) {
+                o << " + ";
+                write_term (terms[i++], false);
+                continue;
+            }
+
+            size_t j = i;
+            while (j < terms.size () && negative (terms[j])) j++;
+
+            o << " - ";
+            if (j - i > 1) o << "(";
+            for (size_t k = i; k < j; k++) {
+                if (k > i) o << " + ";
+                write_term (terms[k], false);
+            }
+
+            if (j - i > 1) o << ")";
+            i = j;
+        }
+
+        return o;
+    }
+
+}
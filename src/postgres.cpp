@@ -3,6 +3,7 @@
 
 #include "postgres.hpp"
 #include "program_options.hpp"
+#include "statement.hpp"
 
 namespace Cosmos {
 
@@ -21,7 +22,9 @@ namespace Cosmos {
         std::string dbname = url_match[5];
 
         std::stringstream ss;
-        ss << "host=" << url_match[3] << " port=" << url_match[4] << " dbname=" << url_match[5] << " password=" << url_match[2];
+        // without a timeout, an unreachable server would keep us waiting indefinitely.
+        ss << "host=" << host << " port=" << port << " dbname=" << dbname << " user=" << user << " password=" << password
+            << " connect_timeout=" << ConnectTimeoutSeconds;
 
         return ss.str ();
 
@@ -35,4 +38,246 @@ namespace Cosmos {
 
         return conn;
     }
+
+    database::database (const postgres_URL &url) : URL {url} {}
+
+    database::~database () {
+        {
+            std::lock_guard<std::mutex> lock (Mutex);
+            Stopping = true;
+        }
+
+        Changed.notify_all ();
+        if (Connecting.joinable ()) Connecting.join ();
+    }
+
+    void database::connect () {
+        std::unique_lock<std::mutex> lock (Mutex);
+        start (lock);
+    }
+
+    void database::start (std::unique_lock<std::mutex> &) {
+        if (Status == status::connecting || Status == status::connected) return;
+        if (Connecting.joinable ()) Connecting.join ();
+
+        Status = status::connecting;
+        Connecting = std::thread {&database::attempt, this};
+    }
+
+    void database::attempt () {
+        auto delay = FirstDelay;
+        for (int i = 1; ; i++) {
+            try {
+                auto c = connect_to_database (URL);
+
+                std::lock_guard<std::mutex> lock (Mutex);
+                Connection = c;
+                Transaction = std::make_unique<pqxx::nontransaction> (*Connection);
+                Pipeline = std::make_unique<pqxx::pipeline> (*Transaction);
+
+                // whatever was waiting for the connection is sent by the next thread to receive something.
+                Status = status::connected;
+                Changed.notify_all ();
+                return;
+            } catch (const std::exception &x) {
+                std::unique_lock<std::mutex> lock (Mutex);
+                if (i == MaxAttempts || Stopping) {
+                    Status = status::failed;
+                    Error = x.what ();
+                    Changed.notify_all ();
+                    return;
+                }
+
+                Changed.wait_for (lock, delay, [this] () {
+                    return Stopping;
+                });
+
+                delay *= 2;
+            }
+        }
+    }
+
+    // called with both locks held.
+    void database::disconnect () {
+        Pipeline = nullptr;
+        Transaction = nullptr;
+        Connection = nullptr;
+        // whatever was sent is lost, so it will have to be sent again.
+        for (auto &[query, id] : Waiting) id = {};
+        Abandoned.clear ();
+        Status = status::idle;
+    }
+
+    bool database::send (uint64 statement, const string &sql) {
+        std::unique_lock<std::mutex> lock (Mutex);
+        auto next = Waiting.lower_bound (std::pair {statement, string {}});
+        bool first = next == Waiting.end () || next->first.first != statement;
+
+        Waiting.try_emplace (std::pair {statement, sql});
+        start (lock);
+        return first;
+    }
+
+    void database::discard (uint64 statement) {
+        std::lock_guard<std::mutex> lock (Mutex);
+        auto w = Waiting.lower_bound (std::pair {statement, string {}});
+        while (w != Waiting.end () && w->first.first == statement) {
+            if (w->second) Abandoned.push_back (*w->second);
+            w = Waiting.erase (w);
+        }
+    }
+
+    // The state that we need is copied under Mutex, and then we talk to the
+    // server without it.
+    pqxx::result database::retrieve (uint64 statement, const string &sql) {
+        pqxx::pipeline *pipeline;
+        maybe<pqxx::pipeline::query_id> id;
+        std::vector<std::pair<uint64, string>> unsent;
+        std::vector<pqxx::pipeline::query_id> abandoned;
+
+        {
+            std::unique_lock<std::mutex> lock (Mutex);
+            start (lock);
+            Changed.wait (lock, [this] () {
+                return Status == status::connected || Status == status::failed;
+            });
+
+            if (Status == status::failed) {
+                // the next query will try again.
+                Status = status::idle;
+                Waiting.clear ();
+                Abandoned.clear ();
+                throw exception {} << "could not connect to the database: " << Error;
+            }
+
+            pipeline = Pipeline.get ();
+            std::swap (abandoned, Abandoned);
+
+            if (auto w = Waiting.find (std::pair {statement, sql}); w != Waiting.end ()) {
+                id = w->second;
+                Waiting.erase (w);
+            }
+
+            for (const auto &[query, sent] : Waiting) if (!sent) unsent.push_back (query);
+        }
+
+        // everything that is waiting goes with ours, so that they share a round trip.
+        std::vector<pqxx::pipeline::query_id> ids;
+        ids.reserve (unsent.size ());
+        for (const auto &query : unsent) ids.push_back (pipeline->insert (query.second));
+        if (!id) id = pipeline->insert (sql);
+
+        {
+            std::lock_guard<std::mutex> lock (Mutex);
+            for (size_t i = 0; i < unsent.size (); i++) {
+                // the statement that sent it may have been discarded in the meantime.
+                auto w = Waiting.find (unsent[i]);
+                if (w == Waiting.end () || w->second) abandoned.push_back (ids[i]);
+                else w->second = ids[i];
+            }
+        }
+
+        // results come in the order in which queries were sent, so the
+        // abandoned ones may well be in the way of ours anyway.
+        for (auto a : abandoned) {
+            try {
+                pipeline->retrieve (a);
+            } catch (const pqxx::sql_error &) {}
+        }
+
+        return pipeline->retrieve (*id);
+    }
+
+    pqxx::result database::receive (uint64 statement, const string &sql) {
+        std::lock_guard<std::mutex> using_pipeline (Using);
+        try {
+            return retrieve (statement, sql);
+        } catch (const pqxx::broken_connection &) {
+            // connect again and try once more.
+            {
+                std::lock_guard<std::mutex> lock (Mutex);
+                disconnect ();
+            }
+
+            return retrieve (statement, sql);
+        }
+    }
+
+    namespace {
+
+        // type oids from pg_type.
+        constexpr pqxx::oid Bool = 16;
+        constexpr pqxx::oid Int8 = 20;
+        constexpr pqxx::oid Int2 = 21;
+        constexpr pqxx::oid Int4 = 23;
+        constexpr pqxx::oid Numeric = 1700;
+
+        // a decimal number such as -12.345 as an exact rational.
+        maybe<Q> read_decimal (const std::string &x) {
+            static const std::regex decimal {R"(^(-?)(\d+)(?:\.(\d*))?$)"};
+            std::smatch m;
+            if (!std::regex_match (x, m, decimal)) return {};
+
+            std::string fraction = m[3];
+            Z n {std::string {m[1]} + std::string {m[2]} + fraction};
+            Z d {1};
+            for (size_t i = 0; i < fraction.size (); i++) d = d * Z {10};
+            return Q {n} / math::nonzero<Q> {Q {d}};
+        }
+
+        Diophant::value read_field (const pqxx::field &f) {
+            using Diophant::expression;
+            if (f.is_null ()) return expression::null ();
+
+            std::string x {f.c_str ()};
+            switch (f.type ()) {
+                case Bool: return expression::boolean (x == "t");
+                case Int2:
+                case Int4:
+                case Int8:
+                case Numeric: {
+                    auto q = read_decimal (x);
+                    if (q) return expression::rational (*q);
+                    return expression::string (x);
+                }
+                default: return expression::string (x);
+            }
+        }
+
+        Diophant::value read_result (const pqxx::result &r) {
+            using Diophant::expression;
+
+            std::vector<string> keys;
+            for (int j = 0; j < int (r.columns ()); j++) keys.push_back (r.column_name (j));
+
+            std::vector<Diophant::ref<const expression>> rows;
+            rows.reserve (r.size ());
+            for (int i = 0; i < int (r.size ()); i++) {
+                std::vector<Diophant::ref<const expression>> values;
+                values.reserve (keys.size ());
+                for (int j = 0; j < int (keys.size ()); j++) values.push_back (read_field (r[i][j]));
+                rows.push_back (expression::object (keys, std::move (values)));
+            }
+
+            return expression::list (std::move (rows));
+        }
+
+    }
+
+    Diophant::value query_builtin (ptr<database> db) {
+        return Diophant::expression::builtin ("query", [db] (Diophant::value v) -> Diophant::value {
+            auto sql = Diophant::string_value (v);
+            if (!sql) return Diophant::expression::error ("query requires a string of SQL");
+            return read_result (db->receive (Diophant::statement::current (), *sql));
+        }, [db] (Diophant::value v) {
+            auto sql = Diophant::string_value (v);
+            uint64 statement = Diophant::statement::current ();
+            // outside of a statement, nothing would ever receive the result.
+            if (!sql || statement == 0) return;
+            if (db->send (statement, *sql)) Diophant::statement::finally ([db, statement] () {
+                db->discard (statement);
+            });
+        });
+    }
+
 }
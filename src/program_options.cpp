@@ -1,8 +1,28 @@
 #include "program_options.hpp"
 #include <laserpants/dotenv/dotenv.h>
+#include <iostream>
 
 namespace Cosmos {
 
+    namespace {
+
+        // In one-shot mode, only results are written to standard output.
+        bool Quiet = false;
+
+        struct null_buffer : std::streambuf {
+            int overflow (int c) override {
+                return c;
+            }
+        };
+
+        std::ostream &log () {
+            static null_buffer Null;
+            static std::ostream Nowhere {&Null};
+            return Quiet ? Nowhere : std::cout;
+        }
+
+    }
+
     // first look in the command line options, then look in the env file.
     maybe<string> get_option (const argh::parser &command_line, string option) {
         if (auto o = command_line (string{"--"} + option); o) {
@@ -15,7 +35,7 @@ namespace Cosmos {
         char *val = std::getenv (option.c_str ());
 
         if (val == nullptr) return {};
-        std::cout << "read option " << option << " from env: " << val << std::endl;
+        log () << "read option " << option << " from env: " << val << std::endl;
         return string {val};
     }
 
@@ -25,38 +45,72 @@ namespace Cosmos {
         return x ? *x : default_value;
     }
 
+    // a number, or zero for no limit.
+    uint64 get_limit (const argh::parser &command_line, string option) {
+        maybe<string> x = get_option (command_line, option);
+        if (!x) return 0;
+
+        std::stringstream ss {*x};
+        uint64 limit;
+        if (!(ss >> limit)) throw exception {} << "invalid value \"" << *x << "\" for option " << option;
+        return limit;
+    }
+
     const program_options program_options::read (const argh::parser &command_line) {
 
+        program_options options {};
+
+        // whole statements, which may contain spaces.
+        if (auto o = command_line ("--eval"); o) options.Eval = o.str ();
+        if (auto o = command_line ("--file"); o) options.File = o.str ();
+        if (auto o = command_line ("--csv"); o) options.CSV = o.str ();
+        if (auto o = command_line ("--expr"); o) options.Expression = o.str ();
+        if (auto o = command_line ("--query"); o) options.Query = o.str ();
+        if (auto o = command_line ("--into"); o) options.Into = o.str ();
+        if (bool (options.CSV) && bool (options.Query)) throw exception {} << "options --csv and --query cannot be used together";
+        if (bool (options.Expression) != (bool (options.CSV) || bool (options.Query)))
+            throw exception {} << "option --expr goes together with --csv or --query";
+        if (bool (options.Into) && !bool (options.Query)) throw exception {} << "option --into goes together with --query";
+        Quiet = options.one_shot ();
+
         string env_path;
 
         if (auto option = command_line ("--env", ".env"); option) {
             option >> env_path;
         } else {
             env_path = ".env";
-            std::cout << "No option --env provided in command line options." << std::endl;
+            log () << "No option --env provided in command line options." << std::endl;
         }
 
-        std::cout << "searching for env file at " << env_path << std::endl;
+        log () << "searching for env file at " << env_path << std::endl;
 
         // it's not an error if this fails.
         dotenv::init (env_path.c_str ());
 
-        program_options options {};
-
         maybe<string> database_url = get_option (command_line, "db_url");
 
         if (database_url) {
-            *options.DatabaseURL = postgres_URL {*database_url};
+            options.DatabaseURL = postgres_URL {*database_url};
             if (!options.DatabaseURL->valid ()) throw exception {} << "could not read database URL \"" << *database_url << "\"";
-        } else std::cout << "No database URL found. Use option --db_url to specify a postgres database to connect to." << std::endl;
+        } else log () << "No database URL found. Use option --db_url to specify a postgres database to connect to." << std::endl;
 
         maybe<string> http_listener_port = get_option (command_line, "http_listener_port");
 
         if (http_listener_port) {
             std::stringstream ss {*http_listener_port};
+            options.HTTPListenerPort = uint16 {0};
             ss >> *options.HTTPListenerPort;
             if (*options.HTTPListenerPort == 0) throw exception {} << "invalid http listener port \"" << *http_listener_port << "\"";
-        } else std::cout << "No listener port found. Use option --http_listener_port to specify a port to listen on." << std::endl;
+        } else log () << "No listener port found. Use option --http_listener_port to specify a port to listen on." << std::endl;
+
+        options.Budget.Steps = get_limit (command_line, "max_steps");
+        options.Budget.Nodes = get_limit (command_line, "max_nodes");
+        options.Budget.Bytes = get_limit (command_line, "max_bytes");
+        options.Budget.Time = std::chrono::milliseconds {get_limit (command_line, "time_limit_ms")};
+
+        options.Journal = get_option (command_line, "journal");
+        if (uint64 interval = get_limit (command_line, "journal_interval_ms"); interval != 0)
+            options.JournalInterval = std::chrono::milliseconds {interval};
 
         return options;
 
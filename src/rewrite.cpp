@@ -0,0 +1,270 @@
+#include <algorithm>
+
+#include "rewrite.hpp"
+
+namespace Diophant {
+
+    namespace {
+
+        bool inline is_symbol (value p) {
+            return p != nullptr && p->kind () == stats::node::symbol;
+        }
+
+        bool inline is_variable (value p, const std::set<data::string> &variables) {
+            return is_symbol (p) && variables.contains (p->write ());
+        }
+
+        // the symbols of a pattern that are variables, which are those not at the head of an application.
+        void variables (value p, std::set<data::string> &out, bool head = false) {
+            if (p == nullptr) return;
+            if (is_symbol (p)) {
+                if (!head) out.insert (p->write ());
+                return;
+            }
+
+            bool apply = p->kind () == stats::node::apply;
+            for (size_t i = 0; i < p->arity (); i++) variables (p->child (i), out, apply && i == 0);
+        }
+
+        // the key of a subexpression in the discrimination tree.
+        uint64 inline key (value v) {
+            if (v == nullptr) return structural_hash (v);
+            return combine (v->head (), v->arity ());
+        }
+
+        // replace symbols that stand for values with their values.
+        ref<const expression> resolve (value p, const scope &vars) {
+            if (p == nullptr) return p;
+
+            if (is_symbol (p)) {
+                auto x = vars.find (p->write ());
+                // an unknown is bound to itself and is a variable here.
+                if (x == nullptr || is_symbol (*x)) return p;
+                return *x;
+            }
+
+            size_t n = p->arity ();
+            if (n == 0) return p;
+
+            std::vector<ref<const expression>> children;
+            children.reserve (n);
+            for (size_t i = 0; i < n; i++) children.push_back (resolve (p->child (i), vars));
+            return p->with (std::move (children));
+        }
+
+        bool match (value p, value t, const std::set<data::string> &variables, std::map<data::string, ref<const expression>> &bindings) {
+            if (is_variable (p, variables)) {
+                auto [b, inserted] = bindings.try_emplace (p->write (), t);
+                return inserted || identical (b->second, t);
+            }
+
+            if (p == nullptr || t == nullptr) return p == t;
+            if (p->kind () != t->kind () || p->head () != t->head ()) return false;
+
+            size_t n = p->arity ();
+            if (n != t->arity ()) return false;
+            if (n == 0) return identical (p, t);
+
+            for (size_t i = 0; i < n; i++) if (!match (p->child (i), t->child (i), variables, bindings)) return false;
+            return true;
+        }
+
+        ref<const expression> substitute (value p, const std::map<data::string, ref<const expression>> &bindings) {
+            if (p == nullptr) return p;
+
+            if (is_symbol (p)) {
+                auto b = bindings.find (p->write ());
+                return b == bindings.end () ? p : b->second;
+            }
+
+            size_t n = p->arity ();
+            if (n == 0) return p;
+
+            std::vector<ref<const expression>> children;
+            children.reserve (n);
+            for (size_t i = 0; i < n; i++) children.push_back (substitute (p->child (i), bindings));
+            return p->with (std::move (children));
+        }
+
+        // the sequence of keys for a pattern, with nothing for a variable.
+        void flatten (value p, const std::set<data::string> &variables, std::vector<maybe<uint64>> &keys) {
+            if (is_variable (p, variables)) {
+                keys.push_back ({});
+                return;
+            }
+
+            keys.push_back (key (p));
+            if (p == nullptr) return;
+            for (size_t i = 0; i < p->arity (); i++) flatten (p->child (i), variables, keys);
+        }
+
+    }
+
+    std::pair<ref<const expression>, ref<const expression>> rewriter::add (value left, value right, const scope &vars) {
+        auto l = resolve (left, vars);
+        auto r = resolve (right, vars);
+        add (l, r);
+        return {l, r};
+    }
+
+    void rewriter::add (value left, value right) {
+        if (left == nullptr || is_symbol (left)) throw exception {} << "the left side of a rule cannot be a variable";
+
+        std::set<data::string> vars;
+        variables (left, vars);
+
+        size_t index = Rules.size ();
+        Rules.push_back (rule {left, right, std::move (vars)});
+
+        std::vector<maybe<uint64>> keys;
+        flatten (Rules.back ().Left, Rules.back ().Variables, keys);
+
+        branch *b = &Root;
+        for (const auto &k : keys) {
+            std::unique_ptr<branch> &next = bool (k) ? b->Next[*k] : b->Any;
+            if (next == nullptr) next = std::make_unique<branch> ();
+            b = next.get ();
+        }
+
+        b->Rules.push_back (index);
+
+        // normal forms may be different now.
+        Memo.clear ();
+        Memoized = 0;
+    }
+
+    // todo holds the subexpressions that are still to be visited, the next one last.
+    void rewriter::candidates (const branch &b, std::vector<ref<const expression>> &todo, std::vector<size_t> &out) const {
+        if (todo.empty ()) {
+            out.insert (out.end (), b.Rules.begin (), b.Rules.end ());
+            return;
+        }
+
+        ref<const expression> t = todo.back ();
+        todo.pop_back ();
+
+        if (b.Any != nullptr) candidates (*b.Any, todo, out);
+
+        if (auto next = b.Next.find (key (t)); next != b.Next.end ()) {
+            size_t n = t == nullptr ? 0 : t->arity ();
+            for (size_t i = n; i > 0; i--) todo.push_back (t->child (i - 1));
+            candidates (*next->second, todo, out);
+            todo.resize (todo.size () - n);
+        }
+
+        todo.push_back (t);
+    }
+
+    value rewriter::remembered (value v) const {
+        auto m = Memo.find (v->hash ());
+        if (m == Memo.end ()) return nullptr;
+        for (const auto &[from, to] : m->second) if (identical (from, v)) return to;
+        return nullptr;
+    }
+
+    void rewriter::remember (value from, value to) {
+        if (Memoized >= MaxMemo) {
+            Memo.clear ();
+            Memoized = 0;
+        }
+
+        Memo[from->hash ()].emplace_back (from, to);
+        Memoized++;
+    }
+
+    value rewriter::normalize (value v, const scope &vars) {
+        // rules are applied with the definitions of vars, so normal forms may be different once they change.
+        if (vars.Memo.Generation != Generation) {
+            Memo.clear ();
+            Memoized = 0;
+            Generation = vars.Memo.Generation;
+        }
+
+        if (Rules.empty ()) return v;
+        size_t steps = 0;
+        return normalize (v, vars, steps);
+    }
+
+    value rewriter::normalize (value v, const scope &vars, size_t &steps) {
+        if (v == nullptr) return v;
+
+        size_t n = v->arity ();
+        if (n > 0) if (auto m = remembered (v); m != nullptr) return m;
+
+        // innermost first.
+        ref<const expression> t = v;
+        if (n > 0) {
+            std::vector<ref<const expression>> children;
+            children.reserve (n);
+            bool changed = false;
+            for (size_t i = 0; i < n; i++) {
+                children.push_back (normalize (v->child (i), vars, steps));
+                changed = changed || children.back ().get () != v->child (i).get ();
+            }
+
+            if (changed) t = v->with (std::move (children));
+        }
+
+        std::vector<ref<const expression>> todo {t};
+        std::vector<size_t> found;
+        candidates (Root, todo, found);
+        // earlier rules take precedence.
+        std::sort (found.begin (), found.end ());
+
+        ref<const expression> result = t;
+        for (size_t r : found) {
+            std::map<data::string, ref<const expression>> bindings;
+            if (!match (Rules[r].Left, t, Rules[r].Variables, bindings)) continue;
+
+            if (++steps > MaxSteps) throw exception {} << "rewriting did not terminate after " << MaxSteps << " steps";
+            meter::step ();
+
+            // evaluating the result folds any constants that the rule exposed.
+            result = normalize (evaluate (substitute (Rules[r].Right, bindings), vars), vars, steps);
+            break;
+        }
+
+        if (n > 0) remember (v, result);
+        return result;
+    }
+
+    void add_standard_rules (rewriter &r) {
+        value x = expression::symbol ("x");
+        value y = expression::symbol ("y");
+        value z = expression::symbol ("z");
+        value zero = expression::rational (Q {Z {0}});
+        value one = expression::rational (Q {Z {1}});
+        value yes = expression::boolean (true);
+        value no = expression::boolean (false);
+
+        // identities
+        r.add (expression::plus (x, zero), x);
+        r.add (expression::plus (zero, x), x);
+        r.add (expression::minus (x, zero), x);
+        r.add (expression::minus (x, x), zero);
+        r.add (expression::times (x, one), x);
+        r.add (expression::times (one, x), x);
+        r.add (expression::times (x, zero), zero);
+        r.add (expression::times (zero, x), zero);
+        r.add (expression::divide (x, one), x);
+        r.add (expression::power (x, one), x);
+        r.add (expression::power (x, zero), one);
+        r.add (expression::negate (expression::negate (x)), x);
+        r.add (expression::boolean_not (expression::boolean_not (x)), x);
+        r.add (expression::boolean_and (x, yes), x);
+        r.add (expression::boolean_and (yes, x), x);
+        r.add (expression::boolean_and (x, no), no);
+        r.add (expression::boolean_and (no, x), no);
+        r.add (expression::boolean_or (x, no), x);
+        r.add (expression::boolean_or (no, x), x);
+        r.add (expression::boolean_or (x, yes), yes);
+        r.add (expression::boolean_or (yes, x), yes);
+
+        // distribution
+        r.add (expression::times (x, expression::plus (y, z)),
+            expression::plus (expression::times (x, y), expression::times (x, z)));
+        r.add (expression::times (expression::plus (x, y), z),
+            expression::plus (expression::times (x, z), expression::times (y, z)));
+    }
+
+}
@@ -0,0 +1,183 @@
+#include <array>
+#include <mutex>
+#include <unordered_map>
+
+#include "rope.hpp"
+#include "hash.hpp"
+#include "budget.hpp"
+
+namespace Diophant {
+
+    // a leaf has text and no children.
+    struct rope::node {
+        ptr<const data::string> Text;
+        ptr<const node> Left;
+        ptr<const node> Right;
+        size_t Size;
+        uint32 Height;
+    };
+
+    namespace {
+
+        using link = ptr<const rope::node>;
+
+        uint32 inline height (const link &n) {
+            return n == nullptr ? 0 : n->Height;
+        }
+
+        link leaf (ptr<const data::string> x) {
+            if (x == nullptr || x->empty ()) return nullptr;
+            return std::make_shared<rope::node> (rope::node {x, nullptr, nullptr, x->size (), 1});
+        }
+
+        link make (const link &l, const link &r) {
+            return std::make_shared<rope::node> (rope::node {nullptr, l, r, l->Size + r->Size, std::max (l->Height, r->Height) + 1});
+        }
+
+        void each (const link &n, const std::function<void (std::string_view)> &f) {
+            if (n == nullptr) return;
+            if (n->Text != nullptr) return f (*n->Text);
+            each (n->Left, f);
+            each (n->Right, f);
+        }
+
+        // the concatenation of two ropes whose heights differ by no more than two.
+        link balance (link l, link r) {
+            if (height (l) > height (r) + 1) {
+                if (height (l->Left) < height (l->Right)) l = make (make (l->Left, l->Right->Left), l->Right->Right);
+                return make (l->Left, make (l->Right, r));
+            }
+
+            if (height (r) > height (l) + 1) {
+                if (height (r->Right) < height (r->Left)) r = make (r->Left->Left, make (r->Left->Right, r->Right));
+                return make (make (l, r->Left), r->Right);
+            }
+
+            return make (l, r);
+        }
+
+        // We go down the side of the taller rope until we reach a subtree
+        // about as tall as the other rope, so only the nodes along one path
+        // are made again.
+        link join (const link &l, const link &r) {
+            if (l == nullptr) return r;
+            if (r == nullptr) return l;
+
+            if (l->Size + r->Size <= rope::Short) {
+                std::string x;
+                x.reserve (l->Size + r->Size);
+                each (l, [&x] (std::string_view s) {
+                    x.append (s);
+                });
+                each (r, [&x] (std::string_view s) {
+                    x.append (s);
+                });
+
+                meter::bytes (x.size ());
+                return leaf (std::make_shared<const data::string> (x));
+            }
+
+            if (height (l) > height (r) + 1) return balance (l->Left, join (l->Right, r));
+            if (height (r) > height (l) + 1) return balance (join (l, r->Left), r->Right);
+            return make (l, r);
+        }
+
+        // Interned strings remove themselves from the table when the last
+        // reference to them is gone. The table is divided into shards by
+        // hash, each with its own lock, so that sessions reading symbols in
+        // different threads rarely wait for each other. The table is never
+        // destroyed, since interned strings may outlive any static object.
+        struct shard {
+            std::mutex Mutex;
+            std::unordered_map<std::string_view, std::weak_ptr<const data::string>> Strings;
+        };
+
+        constexpr size_t Shards = 64;
+
+        shard &interned (std::string_view x) {
+            static auto *Table = new std::array<shard, Shards> {};
+            return (*Table)[hash_bytes (x) % Shards];
+        }
+
+        void release (const data::string *x) {
+            shard &t = interned (*x);
+            {
+                std::lock_guard<std::mutex> lock {t.Mutex};
+                // the entry may belong to a new copy of the same string already.
+                auto i = t.Strings.find (std::string_view {*x});
+                if (i != t.Strings.end () && i->first.data () == x->data ()) t.Strings.erase (i);
+            }
+
+            delete x;
+        }
+
+    }
+
+    rope::rope (const data::string &x) : Root {leaf (std::make_shared<const data::string> (x))} {}
+
+    rope::rope (ptr<const data::string> x) : Root {leaf (x)} {}
+
+    size_t rope::size () const {
+        return Root == nullptr ? 0 : Root->Size;
+    }
+
+    rope rope::operator + (const rope &r) const {
+        return rope {join (Root, r.Root)};
+    }
+
+    bool rope::operator == (const rope &r) const {
+        if (Root == r.Root) return true;
+        if (size () != r.size ()) return false;
+        return flatten () == r.flatten ();
+    }
+
+    void rope::each (const std::function<void (std::string_view)> &f) const {
+        Diophant::each (Root, f);
+    }
+
+    uint64 rope::hash () const {
+        uint64 h = hash_bytes ("");
+        each ([&h] (std::string_view x) {
+            h = hash_bytes (x, h);
+        });
+
+        return h;
+    }
+
+    data::string rope::flatten () const {
+        if (Root != nullptr && Root->Text != nullptr) return *Root->Text;
+
+        std::string x;
+        x.reserve (size ());
+        each ([&x] (std::string_view s) {
+            x.append (s);
+        });
+
+        return data::string {x};
+    }
+
+    std::ostream &rope::write (std::ostream &o) const {
+        each ([&o] (std::string_view x) {
+            o.write (x.data (), std::streamsize (x.size ()));
+        });
+
+        return o;
+    }
+
+    ptr<const data::string> intern (std::string_view x) {
+        shard &t = interned (x);
+        std::lock_guard<std::mutex> lock {t.Mutex};
+
+        auto i = t.Strings.find (x);
+        if (i != t.Strings.end ()) {
+            if (auto s = i->second.lock (); s != nullptr) return s;
+            // the old copy is being released; its key must not outlive it.
+            t.Strings.erase (i);
+        }
+
+        ptr<const data::string> s {new data::string {std::string {x}}, release};
+        t.Strings.emplace (std::string_view {*s}, s);
+        return s;
+    }
+
+}
@@ -0,0 +1,37 @@
+#include <atomic>
+
+#include "statement.hpp"
+
+namespace Diophant {
+
+    namespace {
+
+        std::atomic<uint64> Statements {1};
+
+    }
+
+    thread_local statement *statement::Current {nullptr};
+
+    statement::statement () : Number {Statements.fetch_add (1, std::memory_order_relaxed)}, Finally {}, Previous {Current} {
+        Current = this;
+    }
+
+    statement::~statement () {
+        Current = Previous;
+        while (!Finally.empty ()) {
+            auto f = std::move (Finally.back ());
+            Finally.pop_back ();
+            f ();
+        }
+    }
+
+    uint64 statement::current () {
+        return Current == nullptr ? 0 : Current->Number;
+    }
+
+    void statement::finally (std::function<void ()> f) {
+        if (Current == nullptr) return f ();
+        Current->Finally.push_back (std::move (f));
+    }
+
+}
@@ -0,0 +1,132 @@
+#include "stats.hpp"
+
+namespace Diophant::stats {
+
+    const char *name (node n) {
+        switch (n) {
+            case node::boolean: return "boolean";
+            case node::rational: return "rational";
+            case node::symbol: return "symbol";
+            case node::string: return "string";
+            case node::list: return "list";
+            case node::object: return "object";
+            case node::part: return "part";
+            case node::apply: return "apply";
+            case node::negate: return "negate";
+            case node::boolean_not: return "boolean_not";
+            case node::plus: return "plus";
+            case node::minus: return "minus";
+            case node::times: return "times";
+            case node::power: return "power";
+            case node::divide: return "divide";
+            case node::equal: return "equal";
+            case node::unequal: return "unequal";
+            case node::greater_equal: return "greater_equal";
+            case node::less_equal: return "less_equal";
+            case node::greater: return "greater";
+            case node::less: return "less";
+            case node::boolean_and: return "boolean_and";
+            case node::boolean_or: return "boolean_or";
+            case node::arrow: return "arrow";
+            case node::intuitionistic_and: return "intuitionistic_and";
+            case node::intuitionistic_or: return "intuitionistic_or";
+            case node::intuitionistic_implies: return "intuitionistic_implies";
+            case node::polynomial: return "polynomial";
+            case node::builtin: return "builtin";
+            case node::error: return "error";
+            case node::modular: return "modular";
+            case node::bytes: return "bytes";
+            default: return "unknown";
+        }
+    }
+
+    void histogram::record (std::chrono::nanoseconds d) {
+        uint64 ns = d.count () < 0 ? 0 : uint64 (d.count ());
+        size_t i = 0;
+        while (i < Buckets && ns >= bound (i)) i++;
+        Count[i].fetch_add (1, std::memory_order_relaxed);
+        Nanoseconds.fetch_add (ns, std::memory_order_relaxed);
+    }
+
+    counters &get () {
+        static counters Counters {};
+        return Counters;
+    }
+
+    namespace {
+
+        uint64 total (const histogram &h) {
+            uint64 n = 0;
+            for (const auto &c : h.Count) n += c.load (std::memory_order_relaxed);
+            return n;
+        }
+
+        std::ostream &write (std::ostream &o, const char *title, const histogram &h) {
+            uint64 n = total (h);
+            o << "\n " << title << ": " << n;
+            if (n == 0) return o;
+
+            o << " (mean " << h.Nanoseconds.load (std::memory_order_relaxed) / n / 1000 << "us)";
+            for (size_t i = 0; i <= histogram::Buckets; i++) {
+                uint64 c = h.Count[i].load (std::memory_order_relaxed);
+                if (c == 0) continue;
+                if (i < histogram::Buckets) o << "\n   < " << histogram::bound (i) / 1024 << "us: " << c;
+                else o << "\n   more: " << c;
+            }
+
+            return o;
+        }
+
+        std::ostream &write_prometheus (std::ostream &o, const char *metric, const histogram &h) {
+            o << "# TYPE " << metric << " histogram\n";
+            uint64 cumulative = 0;
+            for (size_t i = 0; i < histogram::Buckets; i++) {
+                cumulative += h.Count[i].load (std::memory_order_relaxed);
+                o << metric << "_bucket{le=\"" << double (histogram::bound (i)) / 1e9 << "\"} " << cumulative << "\n";
+            }
+
+            cumulative += h.Count[histogram::Buckets].load (std::memory_order_relaxed);
+            o << metric << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+            o << metric << "_sum " << double (h.Nanoseconds.load (std::memory_order_relaxed)) / 1e9 << "\n";
+            return o << metric << "_count " << cumulative << "\n";
+        }
+
+    }
+
+    std::ostream &write (std::ostream &o) {
+        if constexpr (!enabled) return o << "\n statistics are not enabled; build with -DNODE_STATISTICS=ON to collect them.";
+
+        const counters &c = get ();
+        o << "\n evaluations:";
+        for (size_t i = 0; i < size_t (node::count); i++)
+            if (uint64 n = c.Evaluations[i].load (std::memory_order_relaxed); n != 0)
+                o << "\n   " << name (node (i)) << ": " << n;
+
+        uint64 allocated = c.Allocated.load (std::memory_order_relaxed);
+        uint64 freed = c.Freed.load (std::memory_order_relaxed);
+        o << "\n nodes allocated: " << allocated << ", freed: " << freed << ", live: " << allocated - freed;
+        o << "\n numbers made: " << c.Numbers.load (std::memory_order_relaxed);
+        write (o, "parse", c.Parse);
+        return write (o, "evaluate", c.Evaluate);
+    }
+
+    std::ostream &write_prometheus (std::ostream &o) {
+        if constexpr (!enabled) return o;
+
+        const counters &c = get ();
+        o << "# TYPE node_evaluations_total counter\n";
+        for (size_t i = 0; i < size_t (node::count); i++)
+            o << "node_evaluations_total{type=\"" << name (node (i)) << "\"} "
+                << c.Evaluations[i].load (std::memory_order_relaxed) << "\n";
+
+        o << "# TYPE node_nodes_allocated_total counter\n";
+        o << "node_nodes_allocated_total " << c.Allocated.load (std::memory_order_relaxed) << "\n";
+        o << "# TYPE node_nodes_freed_total counter\n";
+        o << "node_nodes_freed_total " << c.Freed.load (std::memory_order_relaxed) << "\n";
+        o << "# TYPE node_numbers_made_total counter\n";
+        o << "node_numbers_made_total " << c.Numbers.load (std::memory_order_relaxed) << "\n";
+        write_prometheus (o, "node_parse_seconds", c.Parse);
+        return write_prometheus (o, "node_evaluate_seconds", c.Evaluate);
+    }
+
+}
@@ -0,0 +1,239 @@
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "stream.hpp"
+#include "calc.hpp"
+
+namespace Cosmos {
+
+    namespace {
+
+        // A queue from one thread to another which holds no more than
+        // Capacity items, so that a fast producer waits for a slow consumer.
+        template <typename X> struct channel {
+            channel (size_t capacity) : Capacity {capacity} {}
+
+            // wait for room. Returns false if the channel has been cancelled.
+            bool push (X &&x) {
+                std::unique_lock<std::mutex> lock {Mutex};
+                Changed.wait (lock, [this] () {
+                    return Cancelled || Items.size () < Capacity;
+                });
+
+                if (Cancelled) return false;
+                Items.push_back (std::move (x));
+                Changed.notify_all ();
+                return true;
+            }
+
+            // wait for an item. Returns nothing once the channel
+            // has been closed and is empty, or has been cancelled.
+            maybe<X> pop () {
+                std::unique_lock<std::mutex> lock {Mutex};
+                Changed.wait (lock, [this] () {
+                    return Cancelled || Closed || !Items.empty ();
+                });
+
+                if (Cancelled || Items.empty ()) return {};
+                X x = std::move (Items.front ());
+                Items.pop_front ();
+                Changed.notify_all ();
+                return x;
+            }
+
+            // nothing more will be pushed.
+            void close () {
+                std::lock_guard<std::mutex> lock {Mutex};
+                Closed = true;
+                Changed.notify_all ();
+            }
+
+            // something went wrong, so neither end should wait any longer.
+            void cancel () {
+                std::lock_guard<std::mutex> lock {Mutex};
+                Cancelled = true;
+                Changed.notify_all ();
+            }
+
+            bool cancelled () {
+                std::lock_guard<std::mutex> lock {Mutex};
+                return Cancelled;
+            }
+
+        private:
+            size_t Capacity;
+            std::mutex Mutex;
+            std::condition_variable Changed;
+            std::deque<X> Items {};
+            bool Closed {false};
+            bool Cancelled {false};
+        };
+
+        // the number of rows that are passed from one stage to the next together.
+        constexpr size_t Slice = 1 << 14;
+
+        // the number of slices that may wait between two stages.
+        constexpr size_t Waiting = 4;
+
+        struct slice {
+            std::vector<Diophant::column> Columns;
+            size_t Rows;
+        };
+
+        // the query without a final semicolon, so that it can be used as a subquery.
+        string subquery (const string &query) {
+            size_t end = query.find_last_not_of (" \t\r\n;");
+            return string {end == std::string::npos ? std::string {} : query.substr (0, end + 1)};
+        }
+
+        std::vector<string> column_names (pqxx::work &tx, const string &query) {
+            pqxx::result r = tx.exec ("select * from (" + subquery (query) + ") as q limit 0");
+            std::vector<string> names;
+            for (int j = 0; j < int (r.columns ()); j++) names.push_back (string {r.column_name (j)});
+            return names;
+        }
+
+        // undefined values are null.
+        std::optional<std::string> text (const Diophant::column &c, size_t i) {
+            if (!c.defined (i)) return {};
+            if (!c.Exact) return std::to_string (c.Words[i]);
+
+            std::stringstream ss;
+            ss << c.Rationals[i].Numerator;
+            if (c.Rationals[i].Denominator != 1) ss << "/" << c.Rationals[i].Denominator;
+            return ss.str ();
+        }
+
+        void evaluate (const Diophant::program &p, channel<slice> &in, channel<Diophant::column> &out) {
+            while (auto s = in.pop ()) {
+                std::vector<const Diophant::column *> pointers (s->Columns.size (), nullptr);
+                for (size_t j = 0; j < pointers.size (); j++) if (p.uses (j)) pointers[j] = &s->Columns[j];
+                if (!out.push (p.run (pointers, s->Rows))) return;
+            }
+
+            out.close ();
+        }
+
+        void write (channel<Diophant::column> &in, std::ostream &results) {
+            std::string out;
+            while (auto c = in.pop ()) {
+                out.clear ();
+                Diophant::write_lines (out, *c);
+                results.write (out.data (), std::streamsize (out.size ()));
+            }
+
+            results.flush ();
+        }
+
+        // the table is only changed if every row was evaluated.
+        void copy (const postgres_URL &url, const string &table, channel<Diophant::column> &in) {
+            ptr<pqxx::connection> conn = connect_to_database (url);
+            pqxx::work tx {*conn};
+            auto to = pqxx::stream_to::table (tx, {std::string_view {table}});
+
+            while (auto c = in.pop ())
+                for (size_t i = 0; i < c->size (); i++) to.write_values (text (*c, i));
+
+            if (in.cancelled ()) return;
+            to.complete ();
+            tx.commit ();
+        }
+
+    }
+
+    void stream (const postgres_URL &url, const string &query, const string &expression,
+        const maybe<string> &into, std::ostream &results) {
+
+        ptr<pqxx::connection> conn = connect_to_database (url);
+        pqxx::work tx {*conn};
+
+        std::vector<string> names = column_names (tx, query);
+
+        session s {};
+        Diophant::program p = s.compile (expression, names);
+
+        channel<slice> decoded {Waiting};
+        channel<Diophant::column> evaluated {Waiting};
+
+        std::exception_ptr errors[3] {};
+
+        auto cancel = [&] () {
+            decoded.cancel ();
+            evaluated.cancel ();
+        };
+
+        std::thread evaluating {[&] () {
+            try {
+                evaluate (p, decoded, evaluated);
+            } catch (...) {
+                errors[1] = std::current_exception ();
+                cancel ();
+            }
+        }};
+
+        std::thread encoding {[&] () {
+            try {
+                if (into) copy (url, *into, evaluated);
+                else write (evaluated, results);
+            } catch (...) {
+                errors[2] = std::current_exception ();
+                cancel ();
+            }
+        }};
+
+        // rows are decoded on this thread, which owns the connection.
+        try {
+            auto from = pqxx::stream_from::query (tx, query);
+
+            auto fresh = [&names] () {
+                return slice {std::vector<Diophant::column> (names.size ()), 0};
+            };
+
+            slice next = fresh ();
+            size_t row = 0;
+            while (auto fields = from.read_row ()) {
+                row++;
+                if (fields->size () != names.size ())
+                    throw exception {} << "row " << row << " has " << fields->size () << " fields but there are " << names.size () << " columns";
+
+                for (size_t j = 0; j < names.size (); j++) {
+                    if (!p.uses (j)) continue;
+                    const pqxx::zview &f = (*fields)[j];
+                    if (f.data () == nullptr) {
+                        next.Columns[j].push_undefined ();
+                        continue;
+                    }
+
+                    try {
+                        Diophant::read_number (f, next.Columns[j]);
+                    } catch (const std::exception &e) {
+                        throw exception {} << "row " << row << ": " << e.what ();
+                    }
+                }
+
+                if (++next.Rows == Slice) {
+                    if (!decoded.push (std::move (next))) break;
+                    next = fresh ();
+                }
+            }
+
+            if (next.Rows > 0) decoded.push (std::move (next));
+            decoded.close ();
+            if (!decoded.cancelled ()) from.complete ();
+        } catch (...) {
+            errors[0] = std::current_exception ();
+            cancel ();
+        }
+
+        evaluating.join ();
+        encoding.join ();
+        for (auto &e : errors) if (e) std::rethrow_exception (e);
+    }
+
+}
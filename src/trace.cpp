@@ -0,0 +1,75 @@
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "trace.hpp"
+
+namespace Diophant::trace {
+
+    std::atomic<bool> Enabled {false};
+
+    namespace {
+
+        std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now ();
+
+        std::mutex Mutex;
+
+        // all buffers that have ever been created. They are kept after their
+        // threads exit so that their events can still be written out.
+        std::vector<ptr<ring>> Rings;
+
+        ptr<ring> make_ring () {
+            std::lock_guard<std::mutex> lock (Mutex);
+            auto r = std::make_shared<ring> (uint32 (Rings.size () + 1));
+            Rings.push_back (r);
+            return r;
+        }
+
+    }
+
+    void enable () {
+        if constexpr (compiled) Enabled.store (true, std::memory_order_relaxed);
+        else throw exception {} << "tracing is not compiled in; build with -DNODE_TRACING=ON";
+    }
+
+    void disable () {
+        Enabled.store (false, std::memory_order_relaxed);
+    }
+
+    void ring::record (std::string_view name, char phase) {
+        uint64 i = Next.load (std::memory_order_relaxed);
+        Events[i & (Size - 1)] = event {
+            uint64 (std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now () - Start).count ()),
+            name, phase};
+        Next.store (i + 1, std::memory_order_release);
+    }
+
+    ring &local () {
+        thread_local ptr<ring> Local = make_ring ();
+        return *Local;
+    }
+
+    std::ostream &write (std::ostream &o) {
+        nlohmann::json events = nlohmann::json::array ();
+
+        std::lock_guard<std::mutex> lock (Mutex);
+        for (const auto &r : Rings) {
+            uint64 end = r->Next.load (std::memory_order_acquire);
+            uint64 begin = end > ring::Size ? end - ring::Size : 0;
+            for (uint64 i = begin; i < end; i++) {
+                const event &e = r->Events[i & (ring::Size - 1)];
+                events.push_back ({
+                    {"name", std::string {e.Name}},
+                    {"ph", std::string (1, e.Phase)},
+                    {"ts", double (e.Nanoseconds) / 1000},
+                    {"pid", 1},
+                    {"tid", r->Thread}});
+            }
+        }
+
+        return o << nlohmann::json {{"traceEvents", events}, {"displayTimeUnit", "ns"}}.dump ();
+    }
+
+}
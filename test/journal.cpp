@@ -0,0 +1,117 @@
+#include <chrono>
+#include <filesystem>
+
+#include <gtest/gtest.h>
+
+#include "calc.hpp"
+#include "journal.hpp"
+#include "expression.hpp"
+
+namespace Cosmos {
+
+    // What is written must read back as the same expression, or the
+    // journal would recover something other than what was defined.
+    TEST (Journal, WriteReadsBack) {
+        session s {};
+        for (const string &x : {
+            "(1 + 2) * 3",
+            "(1 - 2) - 3",
+            "1 - (2 - 3)",
+            "(a / b) / c",
+            "a - b + c",
+            "(a + b) - c",
+            "-(a * b)",
+            "(-a) ^ 2",
+            "(a ^ b) ^ c",
+            "a ^ (b ^ c)",
+            "f (g x)",
+            "(f x) y",
+            "(a == b) == c",
+            "1 / 2 + x"}) {
+            Diophant::value v = s.read (x);
+            Diophant::value w = s.read (v->write ());
+            EXPECT_TRUE (Diophant::identical (v, w)) << x << " was written as " << v->write ();
+        }
+    }
+
+    // Evaluated symbolic results are polynomials, which must read back as the same polynomial.
+    TEST (Journal, PolynomialReadsBack) {
+        session s {};
+        s ("x : Q");
+        s ("y : Q");
+        s ("z : Q");
+        for (const string &x : {
+            "3 * x * x",
+            "x * x * y",
+            "-(x * x)",
+            "x - y - z",
+            "x - y - 2 * z + 1",
+            "(x - y) ^ 3",
+            "(x + y) ^ 2 / 2"}) {
+            auto written = s (x);
+            ASSERT_TRUE (bool (written)) << x;
+            EXPECT_EQ (s (*written), written) << x << " was written as " << *written;
+        }
+    }
+
+    TEST (Journal, Recover) {
+        auto path = std::filesystem::temp_directory_path () / "node_journal_test";
+        std::filesystem::remove (path);
+
+        {
+            journal j {path.string (), std::chrono::milliseconds {10}};
+            EXPECT_TRUE (j.recovered ().empty ());
+            EXPECT_TRUE (j.recovered_rules ().empty ());
+            j.define ("x", "1");
+            j.rule ("f (a)", "a + 1");
+            j.define ("x", "2");
+        }
+
+        {
+            journal j {path.string (), std::chrono::milliseconds {10}};
+            EXPECT_EQ (j.recovered ().size (), 1);
+            EXPECT_EQ (j.recovered ().at ("x"), "2");
+            ASSERT_EQ (j.recovered_rules ().size (), 1);
+            EXPECT_EQ (j.recovered_rules ()[0].first, "f (a)");
+            EXPECT_EQ (j.recovered_rules ()[0].second, "a + 1");
+        }
+
+        std::filesystem::remove (path);
+    }
+
+    // a definition made before a statement fails has been made, so it is journaled.
+    TEST (Journal, DefinitionsBeforeAnError) {
+        auto path = std::filesystem::temp_directory_path () / "node_journal_session_test";
+        std::filesystem::remove (path);
+
+        {
+            session s {};
+            s.journal_to (std::make_shared<journal> (path.string (), std::chrono::milliseconds {10}));
+            s ("y := 2");
+            s ("twice : Q");
+            s ("twice z : Q = z * 2");
+            s ("f : Q");
+            s ("f true : Q = 1");
+            EXPECT_EQ (s ("f true"), maybe<string> {"1"});
+            EXPECT_THROW (s ("x := 1 / 0"), std::exception);
+        }
+
+        {
+            session s {};
+            auto j = std::make_shared<journal> (path.string (), std::chrono::milliseconds {10});
+            EXPECT_EQ (j->recovered ().size (), 4);
+            EXPECT_EQ (j->recovered ().count ("x"), 1);
+            EXPECT_EQ (j->recovered_rules ().size (), 2);
+            s.journal_to (j);
+            EXPECT_EQ (s ("y + 3"), maybe<string> {"5"});
+            EXPECT_EQ (s ("twice 5"), maybe<string> {"10"});
+
+            // true is written as a symbol, but it is still true and not a variable.
+            EXPECT_EQ (s ("f true"), maybe<string> {"1"});
+            EXPECT_EQ (s ("f false"), maybe<string> {"f false"});
+        }
+
+        std::filesystem::remove (path);
+    }
+
+}
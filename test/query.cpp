@@ -0,0 +1,18 @@
+#include <gtest/gtest.h>
+
+#include "expression.hpp"
+
+namespace Diophant {
+
+    // query reads a NULL column as null, and the rows must still print.
+    TEST (Query, NullColumn) {
+        std::vector<ref<const expression>> values;
+        values.push_back (expression::rational (Q {Z {1}}));
+        values.push_back (expression::null ());
+        std::vector<ref<const expression>> rows;
+        rows.push_back (expression::object ({"id", "name"}, std::move (values)));
+
+        EXPECT_EQ (expression::list (std::move (rows))->write (), "[{id: 1, name: null}]");
+    }
+
+}
@@ -0,0 +1,20 @@
+#include <gtest/gtest.h>
+
+#include "calc.hpp"
+
+namespace Cosmos {
+
+    // the head of an application on the left of a rule matches only itself.
+    TEST (Rewrite, HeadIsNotAVariable) {
+        session s {};
+        s ("f : Q");
+        s ("g : Q");
+        s ("x : Q");
+        s ("f z : Q = z * 2");
+
+        EXPECT_EQ (s ("f 3"), maybe<string> {"6"});
+        EXPECT_EQ (s ("g 3"), maybe<string> {"g 3"});
+        EXPECT_EQ (s ("g x"), maybe<string> {"g x"});
+    }
+
+}